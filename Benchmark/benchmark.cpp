@@ -0,0 +1,287 @@
+// Headless rendering benchmark over the bundled obj assets.
+// Results are printed as JSON lines (one object per configuration) so that runs can be compared across versions.
+//
+// Windows: build the Benchmark project of TinyRenderer.sln.
+// Linux:   compile benchmark.cpp, scenes.cpp and the TinyRenderer sources except the SDL front end
+//          (main.cpp, overlay.cpp, tinyrenderer.cpp) with -DTR_HEADLESS, e.g. from the repository root
+//          g++ -std=c++17 -O2 -fopenmp -DTR_HEADLESS -ITinyRenderer -IBenchmark Benchmark/benchmark.cpp Benchmark/scenes.cpp
+//              $(ls TinyRenderer/*.cpp | grep -v "main\|overlay\|tinyrenderer") -o benchmark -pthread
+//          ./benchmark --assets obj
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "scenes.h"
+#include "asset_cache.h"
+#include "frame_writer.h"
+#include "counters.h"
+#include "wyj_gl.h"
+
+struct Options {
+    std::string assets = "../obj";
+    std::string out;                 // JSON lines go to stdout when empty
+    std::string dump;                // directory receiving the last frame of each configuration
+    std::string dump_format = "tga"; // extension of the dumped frames, see ImageFormat
+    std::vector<int> sizes = { 256, 800 };
+    std::vector<int> threads;        // defaults to 1, 2, 4, ... up to the number of hardware threads
+    int warmup = 2;
+    int reps = 5;
+    int grid = 4;                    // the procedurally scaled scene holds grid x grid instances, e.g. 64 for 4096
+    std::string only_scene, only_shader;
+    VertexStorage storage = VertexStorage::Double;
+    double zoom = 1;                 // viewport magnification, see Scene::zoom
+    double lod_error = 1;            // pixels, see set_lod_threshold(), 0 draws the full meshes
+    double roll = 0;                 // degrees, see Scene::roll
+    TextureLayout layout = TextureLayout::Linear;
+    bool texture_cache = false;      // simulate a texture cache, see set_texture_cache_simulation()
+    NormalEncoding normals = NormalEncoding::Float3;
+    double asset_budget = 512;       // MB, see AssetCache::set_budget()
+};
+
+static std::vector<int> parse_list(const std::string& s) {
+    std::vector<int> ret;
+    std::istringstream iss(s);
+    std::string item;
+    while (std::getline(iss, item, ',')) ret.push_back(std::atoi(item.c_str()));
+    return ret;
+}
+
+static const char* storage_name(const VertexStorage s) {
+    return s == VertexStorage::Float32 ? "float32" : s == VertexStorage::Quantized ? "quantized" : "double";
+}
+
+static bool parse_storage(const std::string& name, VertexStorage& s) {
+    for (const VertexStorage candidate : { VertexStorage::Double, VertexStorage::Float32, VertexStorage::Quantized }) {
+        if (name != storage_name(candidate)) continue;
+        s = candidate;
+        return true;
+    }
+    return false;
+}
+
+static const char* layout_name(const TextureLayout l) {
+    return l == TextureLayout::Tiled4 ? "tiled4" : l == TextureLayout::Tiled8 ? "tiled8" : l == TextureLayout::Morton ? "morton" : "linear";
+}
+
+static bool parse_layout(const std::string& name, TextureLayout& l) {
+    for (const TextureLayout candidate : { TextureLayout::Linear, TextureLayout::Tiled4, TextureLayout::Tiled8, TextureLayout::Morton }) {
+        if (name != layout_name(candidate)) continue;
+        l = candidate;
+        return true;
+    }
+    return false;
+}
+
+static const char* encoding_name(const NormalEncoding e) {
+    return e == NormalEncoding::Octahedral ? "octahedral" : "float3";
+}
+
+static bool parse_encoding(const std::string& name, NormalEncoding& e) {
+    for (const NormalEncoding candidate : { NormalEncoding::Float3, NormalEncoding::Octahedral }) {
+        if (name != encoding_name(candidate)) continue;
+        e = candidate;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_dump_format(const std::string& name, std::string& extension) {
+    for (const char* candidate : { "tga", "qoi", "ppm" }) {
+        if (name != candidate) continue;
+        extension = candidate;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_options(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--assets" && has_value) opt.assets = argv[++i];
+        else if (arg == "--out" && has_value) opt.out = argv[++i];
+        else if (arg == "--dump" && has_value) opt.dump = argv[++i];
+        else if (arg == "--dump-format" && has_value && parse_dump_format(argv[i + 1], opt.dump_format)) i++;
+        else if (arg == "--sizes" && has_value) opt.sizes = parse_list(argv[++i]);
+        else if (arg == "--threads" && has_value) opt.threads = parse_list(argv[++i]);
+        else if (arg == "--warmup" && has_value) opt.warmup = std::atoi(argv[++i]);
+        else if (arg == "--reps" && has_value) opt.reps = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--grid" && has_value) opt.grid = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--scene" && has_value) opt.only_scene = argv[++i];
+        else if (arg == "--shader" && has_value) opt.only_shader = argv[++i];
+        else if (arg == "--storage" && has_value && parse_storage(argv[i + 1], opt.storage)) i++;
+        else if (arg == "--zoom" && has_value) opt.zoom = std::max(1., std::atof(argv[++i]));
+        else if (arg == "--lod-error" && has_value) opt.lod_error = std::max(0., std::atof(argv[++i]));
+        else if (arg == "--roll" && has_value) opt.roll = std::atof(argv[++i]);
+        else if (arg == "--texture-layout" && has_value && parse_layout(argv[i + 1], opt.layout)) i++;
+        else if (arg == "--texture-cache") opt.texture_cache = true;
+        else if (arg == "--asset-budget" && has_value) opt.asset_budget = std::max(0., std::atof(argv[++i]));
+        else if (arg == "--normal-encoding" && has_value && parse_encoding(argv[i + 1], opt.normals)) i++;
+        else {
+            std::cerr << "usage: benchmark [--assets dir] [--out file] [--dump dir] [--dump-format tga|qoi|ppm] [--sizes 256,800] [--threads 1,2,4] "
+                         "[--warmup n] [--reps n] [--grid n] [--scene name] [--shader random|phong|depth|textured] [--storage double|float32|quantized] [--zoom x] [--lod-error px] "
+                         "[--roll degrees] [--texture-layout linear|tiled4|tiled8|morton] [--texture-cache] [--normal-encoding float3|octahedral] [--asset-budget mb]\n";
+            return false;
+        }
+    }
+    if (opt.threads.empty()) {
+#ifdef _OPENMP
+        for (int n = 1; n < omp_get_max_threads(); n *= 2) opt.threads.push_back(n);
+        opt.threads.push_back(omp_get_max_threads());
+#else
+        opt.threads.push_back(1);
+#endif
+    }
+    return true;
+}
+
+static void set_threads(const int n) {
+#ifdef _OPENMP
+    omp_set_num_threads(n);
+#else
+    (void)n;
+#endif
+}
+
+struct Result {
+    double ms_median = 0, ms_min = 0;
+    double triangles = 0, fragments = 0; // per frame
+    double lod_saved = 0;                // triangles of the full meshes not drawn thanks to the LOD levels, per frame
+    double texels = 0, texture_misses = 0; // per frame, with --texture-cache
+};
+
+static Result run(const Scene& scene, const std::vector<std::unique_ptr<Model>>& models, const ShaderKind kind, const int size, const Options& opt, FrameWriter* dump) {
+    TGAImage framebuffer(size, size, TGAImage::RGB);
+    setup_frame(scene, size, size);
+    for (int i = 0; i < opt.warmup; i++) render_frame(scene, models, kind, framebuffer);
+    PipelineCounters::instance().end_frame(); // drop the warmup counts
+
+    std::vector<double> ms;
+    Result ret;
+    for (int i = 0; i < opt.reps; i++) {
+        auto start = std::chrono::steady_clock::now();
+        render_frame(scene, models, kind, framebuffer);
+        ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        const FrameCounters& c = PipelineCounters::instance().end_frame();
+        ret.triangles = static_cast<double>(c[Counter::TrianglesSubmitted]);
+        ret.fragments = static_cast<double>(c[Counter::FragmentsTested]);
+        ret.lod_saved = static_cast<double>(c[Counter::TrianglesLodSaved]);
+        ret.texels = static_cast<double>(c[Counter::TexelsFetched]);
+        ret.texture_misses = static_cast<double>(c[Counter::TextureCacheMisses]);
+    }
+    if (dump) // written in the background while the next configuration renders
+        dump->submit(opt.dump + "/" + scene.name + "_" + shader_name(kind) + "_" + std::to_string(size) + "." + opt.dump_format, std::move(framebuffer), false); // row 0 is the top of the screen
+    std::sort(ms.begin(), ms.end());
+    ret.ms_min = ms.front();
+    ret.ms_median = ms[ms.size() / 2];
+    return ret;
+}
+
+// cost of Model::normal(uv) in the current encoding, the octahedral one still normalizes each decoded vector
+static double normal_sample_ns(const std::vector<std::unique_ptr<Model>>& models) {
+    constexpr int kGrid = 512;
+    double sum = 0, ns = 0;
+    int n = 0;
+    for (const auto& m : models) {
+        if (m->tangent_normals().empty()) continue;
+        const auto start = std::chrono::steady_clock::now();
+        for (int y = 0; y < kGrid; y++)
+            for (int x = 0; x < kGrid; x++) sum += m->normal(vec2{ (x + .5) / kGrid, (y + .5) / kGrid }).z;
+        ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        n += kGrid * kGrid;
+    }
+    volatile double sink = sum; // keeps the samples from being optimized away
+    (void)sink;
+    return n ? ns / n : 0;
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_options(argc, argv, opt)) return 1;
+    std::ofstream file;
+    if (!opt.out.empty()) {
+        file.open(opt.out);
+        if (!file.is_open()) {
+            std::cerr << "can't open file " << opt.out << "\n";
+            return 1;
+        }
+    }
+    std::ostream& out = opt.out.empty() ? std::cout : file;
+
+    set_lod_threshold(opt.lod_error);
+    set_texture_cache_simulation(opt.texture_cache);
+    AssetCache::instance().set_budget(static_cast<std::size_t>(opt.asset_budget * (1 << 20)));
+    std::vector<Scene> scenes = standard_scenes(opt.grid);
+    std::unique_ptr<FrameWriter> dump = opt.dump.empty() ? nullptr : std::make_unique<FrameWriter>();
+    for (Scene& scene : scenes) {
+        scene.zoom = opt.zoom;
+        scene.roll = opt.roll;
+    }
+    const ShaderKind shaders[] = { ShaderKind::Random, ShaderKind::Phong, ShaderKind::Depth, ShaderKind::Textured };
+
+    out << "{\"benchmark\":\"tinyrenderer\",\"version\":1,\"warmup\":" << opt.warmup << ",\"reps\":" << opt.reps
+        << ",\"storage\":\"" << storage_name(opt.storage) << "\",\"zoom\":" << opt.zoom << ",\"lod_error\":" << opt.lod_error
+        << ",\"roll\":" << opt.roll << ",\"texture_layout\":\"" << layout_name(opt.layout)
+        << "\",\"normal_encoding\":\"" << encoding_name(opt.normals) << "\"}\n";
+    for (const Scene& scene : scenes) {
+        if (!opt.only_scene.empty() && opt.only_scene != scene.name) continue;
+        std::vector<std::unique_ptr<Model>> models;
+        if (!load_scene(scene, opt.assets, models)) {
+            std::cerr << "skipping the scene " << scene.name << "\n";
+            continue;
+        }
+        std::size_t mesh_bytes = 0, texture_bytes = 0;
+        for (auto& m : models) {
+            m->set_storage(opt.storage);
+            m->set_texture_layout(opt.layout);
+            m->set_normal_encoding(opt.normals);
+            mesh_bytes += m->geometry_bytes();
+            texture_bytes += m->texture_bytes();
+        }
+        const double normal_ns = normal_sample_ns(models);
+
+        for (const ShaderKind kind : shaders) {
+            if (!opt.only_shader.empty() && opt.only_shader != shader_name(kind)) continue;
+            for (const int size : opt.sizes) {
+                double fps1 = 0;
+                for (const int n : opt.threads) {
+                    set_threads(n);
+                    Result r = run(scene, models, kind, size, opt, dump.get());
+                    double fps = 1000. / r.ms_median;
+                    if (n == 1) fps1 = fps;
+                    out << "{\"scene\":\"" << scene.name << "\",\"shader\":\"" << shader_name(kind)
+                        << "\",\"width\":" << size << ",\"height\":" << size << ",\"threads\":" << n
+                        << ",\"ms_median\":" << r.ms_median << ",\"ms_min\":" << r.ms_min
+                        << ",\"fps\":" << fps
+                        << ",\"triangles_per_sec\":" << r.triangles * fps
+                        << ",\"fragments_per_sec\":" << r.fragments * fps
+                        << ",\"triangles_lod_saved\":" << r.lod_saved
+                        << ",\"mesh_bytes\":" << mesh_bytes
+                        << ",\"texture_bytes\":" << texture_bytes
+                        << ",\"normal_sample_ns\":" << normal_ns;
+                    if (opt.texture_cache) out << ",\"texels_fetched\":" << r.texels << ",\"texture_cache_misses\":" << r.texture_misses;
+                    if (fps1 > 0) out << ",\"efficiency\":" << fps / (fps1 * n); // thread-scaling efficiency w.r.t. one thread
+                    out << "}" << std::endl;
+                }
+            }
+        }
+    }
+    if (dump) {
+        dump->flush();
+        std::cerr << "# dumped " << dump->written() << " frames, " << dump->failed() << " failed, render loop blocked " << dump->blocked_ms() << " ms" << std::endl;
+    }
+    const AssetStats assets = AssetCache::instance().stats();
+    std::cerr << "# asset cache " << assets.entries << " entries in " << assets.bytes / 1024 << " KB, " << assets.hits << " hits, "
+        << assets.misses << " misses, " << assets.evictions << " evictions" << std::endl;
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include "scenes.h"
+#include "wyj_gl.h"
+#include "shaders.h"
+
+const char* shader_name(const ShaderKind s) {
+    return s == ShaderKind::Random ? "random" : s == ShaderKind::Phong ? "phong" : s == ShaderKind::Textured ? "textured" : "depth";
+}
+
+std::vector<Scene> standard_scenes(const int grid) {
+    return {
+        { "african_head", { "african_head/african_head.obj", "african_head/african_head_eye_inner.obj", "african_head/african_head_eye_outer.obj" }, 1, { -1, 0, 2 } },
+        { "diablo3_pose", { "diablo3_pose/diablo3_pose.obj" }, 1, { -1, 0, 2 } },
+        { "boggie",       { "boggie/head.obj", "boggie/body.obj", "boggie/eyes.obj" }, 1, { -1, 0, 2 } },
+        { "scaled_grid",  { "african_head/african_head.obj" }, grid, { 0, 0, 3 } },
+    };
+}
+
+bool load_scene(const Scene& scene, const std::string& assets, std::vector<std::unique_ptr<Model>>& models) {
+    models.clear();
+    for (const std::string& f : scene.files) {
+        std::unique_ptr<Model> m(new Model(assets + "/" + f));
+        if (!m->nfaces()) {
+            std::cerr << "can't load " << assets << "/" << f << "\n";
+            return false;
+        }
+        models.push_back(std::move(m));
+    }
+    return true;
+}
+
+void setup_frame(const Scene& scene, const int width, const int height) {
+    init_zbuffer(width, height);
+    const int w = static_cast<int>(width * 7 / 8 * scene.zoom), h = static_cast<int>(height * 7 / 8 * scene.zoom);
+    init_viewport((width - w) / 2, (height - h) / 2, w, h);
+    init_perspective(norm(scene.eye));
+}
+
+void render_frame(const Scene& scene, const std::vector<std::unique_ptr<Model>>& models, const ShaderKind kind, TGAImage& framebuffer) {
+    std::fill(zbuffer.begin(), zbuffer.end(), -std::numeric_limits<double>::max());
+    vec3 up = { 0, 1, 0 };
+    if (scene.roll) { // rotated around the view direction d: up cos + (d x up) sin + d (d * up)(1 - cos)
+        const vec3 d = normalized(vec3{ 0, 0, 0 } - scene.eye);
+        const double a = scene.roll * 3.14159265358979323846 / 180;
+        up = up * std::cos(a) + cross(d, up) * std::sin(a) + d * ((d * up) * (1 - std::cos(a)));
+    }
+    lookat(scene.eye, { 0, 0, 0 }, up);
+    clear_debug_buffers();
+    static InstanceScene instances; // grid x grid instances of every model, sharing its geometry, kept while the scene is the same
+    static std::vector<const Model*> instanced;
+    static int instanced_grid = 0;
+    std::vector<const Model*> current;
+    for (const auto& m : models) current.push_back(m.get());
+    if (current != instanced || scene.grid != instanced_grid) {
+        instances.clear();
+        const double scale = 1. / scene.grid;
+        for (const Model* m : current) {
+            const int model = instances.add_model(*m);
+            for (int i = 0; i < scene.grid; i++)
+                for (int j = 0; j < scene.grid; j++)
+                    instances.add(model, translation_scale({ (2 * i + 1) * scale - 1, (2 * j + 1) * scale - 1, 0 }, scale));
+        }
+        instanced = current;
+        instanced_grid = scene.grid;
+    }
+    else instances.update_bounds(); // Model::set_storage() may have moved the bounds, the hierarchy is refitted
+    for (size_t m = 0; m < models.size(); m++) {
+        const Model& model = *models[m];
+        if (kind == ShaderKind::Random) {
+            RandomShader shader(model);
+            shader.color = { static_cast<std::uint8_t>(50 + 70 * m), static_cast<std::uint8_t>(200 - 40 * m), 128, 255 };
+            draw(shader, instances, static_cast<int>(m), framebuffer);
+        }
+        else if (kind == ShaderKind::Phong) {
+            PhongShader shader({ 1, 1, 1 }, model);
+            draw(shader, instances, static_cast<int>(m), framebuffer);
+        }
+        else if (kind == ShaderKind::Textured && texture_cache_simulated) {
+            TexturedShader<TextureProbe> shader({ 1, 1, 1 }, model);
+            draw(shader, instances, static_cast<int>(m), framebuffer);
+        }
+        else if (kind == ShaderKind::Textured) {
+            TexturedShader<> shader({ 1, 1, 1 }, model);
+            draw(shader, instances, static_cast<int>(m), framebuffer);
+        }
+        else {
+            DepthShader shader(model);
+            draw(shader, instances, static_cast<int>(m), framebuffer);
+        }
+    }
+}
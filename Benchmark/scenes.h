@@ -0,0 +1,25 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "model.h"
+#include "tgaimage.h"
+
+// scenes shared by the benchmark and the regression tests
+struct Scene {
+    std::string name;
+    std::vector<std::string> files; // relative to the assets directory
+    int grid;                       // grid x grid instances of the models, scaled to fit the screen
+    vec3 eye;                       // camera position, looking at the origin
+    double zoom = 1;                // viewport magnification, > 1 pushes parts of the scene off screen
+    double roll = 0;                // camera rotation around the view direction, in degrees
+};
+
+enum class ShaderKind { Random, Phong, Depth, Textured };
+const char* shader_name(const ShaderKind s);
+
+std::vector<Scene> standard_scenes(const int grid); // bundled assets plus a grid x grid scene of heads
+bool load_scene(const Scene& scene, const std::string& assets, std::vector<std::unique_ptr<Model>>& models);
+void setup_frame(const Scene& scene, const int width, const int height); // z-buffer, viewport and perspective
+void render_frame(const Scene& scene, const std::vector<std::unique_ptr<Model>>& models, const ShaderKind kind, TGAImage& framebuffer);
@@ -0,0 +1,677 @@
+// Golden-image and performance regression tests.
+// Renders a matrix of scenes, cameras and shaders headlessly and compares the frames against the golden TGAs,
+// then compares the frame times against a stored baseline. On an image mismatch <name>_diff.tga and
+// <name>_actual.tga are written next to the golden image. The exit code is non-zero when a check fails.
+//
+// Windows: build the Regression project of TinyRenderer.sln and run it from the Regression directory.
+// Linux:   same sources as the benchmark with regression.cpp instead of benchmark.cpp, e.g. from the repository root
+//          g++ -std=c++17 -O2 -fopenmp -DTR_HEADLESS -ITinyRenderer -IBenchmark Regression/regression.cpp Benchmark/scenes.cpp
+//              $(ls TinyRenderer/*.cpp | grep -v "main\|overlay\|tinyrenderer") -o regression -pthread
+//          ./regression --assets obj --golden Regression/golden --baseline Regression/baseline.txt
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "scenes.h"
+#include "asset_cache.h"
+#include "frame_writer.h"
+#include "counters.h"
+#include "instances.h"
+#include "shaders.h"
+#include "wyj_gl.h"
+
+struct Options {
+    std::string assets = "../obj";
+    std::string golden = "golden";          // directory of the golden images
+    std::string baseline = "baseline.txt";  // frame times in ms, one "name ms" pair per line
+    bool update = false;                    // rewrite the golden images and the baseline instead of comparing
+    bool timing = true;
+    int size = 128;
+    int reps = 5;                           // the fastest repetition is compared, after one warmup frame
+    double slack = .25;                     // allowed slowdown w.r.t. the baseline, .25 = 25%
+    double min_psnr = 40.;                  // dB
+    int tolerance = 8;                      // per-channel difference above which a pixel counts as different
+    double max_bad = .001;                  // allowed fraction of different pixels
+    double lod_psnr = 30.;                  // dB, for the frames drawn with the default LOD threshold, the golden images use the full meshes
+};
+
+static bool parse_options(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--assets" && has_value) opt.assets = argv[++i];
+        else if (arg == "--golden" && has_value) opt.golden = argv[++i];
+        else if (arg == "--baseline" && has_value) opt.baseline = argv[++i];
+        else if (arg == "--update") opt.update = true;
+        else if (arg == "--no-timing") opt.timing = false;
+        else if (arg == "--reps" && has_value) opt.reps = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--slack" && has_value) opt.slack = std::atof(argv[++i]);
+        else if (arg == "--psnr" && has_value) opt.min_psnr = std::atof(argv[++i]);
+        else if (arg == "--tolerance" && has_value) opt.tolerance = std::atoi(argv[++i]);
+        else if (arg == "--max-bad" && has_value) opt.max_bad = std::atof(argv[++i]);
+        else if (arg == "--lod-psnr" && has_value) opt.lod_psnr = std::atof(argv[++i]);
+        else {
+            std::cerr << "usage: regression [--assets dir] [--golden dir] [--baseline file] [--update] [--no-timing] [--reps n] "
+                         "[--slack fraction] [--psnr dB] [--tolerance n] [--max-bad fraction] [--lod-psnr dB]\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+struct Comparison {
+    double psnr = 0;   // dB, infinite for identical images
+    double bad = 0;    // fraction of pixels with a channel differing by more than the tolerance
+};
+
+static Comparison compare(const TGAImage& a, const TGAImage& b, const int tolerance, TGAImage& diff) {
+    Comparison ret;
+    double se = 0;
+    int nbad = 0;
+    for (int y = 0; y < a.height(); y++) {
+        for (int x = 0; x < a.width(); x++) {
+            TGAColor ca = a.get(x, y), cb = b.get(x, y), cd = { 0, 0, 0, 255, 3 };
+            int maxd = 0;
+            for (int c : {0, 1, 2}) {
+                int d = std::abs(int(ca[c]) - int(cb[c]));
+                se += d * d;
+                maxd = std::max(maxd, d);
+                cd[c] = static_cast<std::uint8_t>(std::min(255, d * 8)); // amplified difference
+            }
+            if (maxd > tolerance) {
+                nbad++;
+                cd[2] = 255; // mark the pixels over the tolerance in red
+            }
+            diff.set(x, y, cd);
+        }
+    }
+    double mse = se / (3. * a.width() * a.height());
+    ret.psnr = mse > 0 ? 10 * std::log10(255. * 255. / mse) : std::numeric_limits<double>::infinity();
+    ret.bad = double(nbad) / (a.width() * a.height());
+    return ret;
+}
+
+static std::map<std::string, double> read_baseline(const std::string filename) {
+    std::map<std::string, double> ret;
+    std::ifstream in(filename);
+    std::string name;
+    double ms;
+    while (in >> name >> ms) ret[name] = ms;
+    return ret;
+}
+
+template <typename... Parts> static std::string text(const Parts&... parts) { // the parts as std::cerr would print them
+    std::ostringstream out;
+    (out << ... << parts);
+    return out.str();
+}
+
+static bool check_image(const Options& opt, const std::string& name, const std::string& golden_file, const TGAImage& frame) {
+    TGAImage golden;
+    if (!golden.read_tga_file(golden_file) || golden.width() != frame.width() || golden.height() != frame.height()) {
+        std::cerr << "FAIL " << name << ": missing golden image or size mismatch\n";
+        frame.write_tga_file(opt.golden + "/" + name + "_actual.tga", false);
+        return false;
+    }
+    TGAImage diff(frame.width(), frame.height(), TGAImage::RGB);
+    Comparison c = compare(frame, golden, opt.tolerance, diff);
+    bool ok = c.psnr >= opt.min_psnr && c.bad <= opt.max_bad;
+    std::cerr << (ok ? "ok   " : "FAIL ") << name << ": psnr " << c.psnr << " dB, " << c.bad * 100 << "% pixels over tolerance\n";
+    if (!ok) {
+        diff.write_tga_file(opt.golden + "/" + name + "_diff.tga", false);
+        frame.write_tga_file(opt.golden + "/" + name + "_actual.tga", false);
+    }
+    return ok;
+}
+
+// every triangle of every LOD level in exactly one meshlet of that level, with its corners pointing to the same vertices as the index arrays
+static bool check_meshlets(const Model& model) {
+    std::vector<int> owners(model.total_faces(), 0);
+    const int* vertices = model.meshlet_vertices();
+    const std::uint8_t* corners = model.meshlet_indices();
+    const std::vector<Meshlet>& meshlets = model.meshlets();
+    int next_face = 0, next_meshlet = 0;
+    for (const LodLevel& lod : model.lods()) {
+        if (lod.first_face != next_face || lod.first_meshlet != next_meshlet) return false;
+        next_face += lod.nfaces;
+        next_meshlet += lod.nmeshlets;
+        for (int i = lod.first_meshlet; i < lod.first_meshlet + lod.nmeshlets; i++) {
+            const Meshlet& m = meshlets[i];
+            if (m.vertex_count > kMeshletVertices || m.triangle_count > kMeshletTriangles || !m.triangle_count) return false;
+            for (int t = m.triangle_offset; t < m.triangle_offset + m.triangle_count; t++) {
+                const int f = model.meshlet_faces()[t];
+                if (f < lod.first_face || f >= lod.first_face + lod.nfaces) return false;
+                owners[f]++;
+                for (int k = 0; k < 3; k++)
+                    if (corners[t * 3 + k] >= m.vertex_count || vertices[m.vertex_offset + corners[t * 3 + k]] != model.vert_index(f, k)) return false;
+            }
+        }
+    }
+    return next_face == model.total_faces() && next_meshlet == static_cast<int>(meshlets.size()) &&
+        std::all_of(owners.begin(), owners.end(), [](const int n) { return n == 1; });
+}
+
+// a mesh cache whose header matches but whose face indices or LOD levels are out of range is regenerated, not indexed
+static bool check_corrupt_mesh_cache(const std::string& obj) {
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::string path = (dir / "tinyrenderer_corrupt.obj").string(), cachefile = (dir / "tinyrenderer_corrupt.trmesh").string();
+    std::error_code ec;
+    std::filesystem::copy_file(obj, path, std::filesystem::copy_options::overwrite_existing, ec);
+    std::filesystem::remove(cachefile, ec);
+    const Model reference(path, ObjLoader::Stream);
+    { const Model written(path); } // writes the cache
+    std::ifstream in(cachefile, std::ios::binary);
+    const std::string pristine((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    auto find = [&pristine](const std::vector<int>& ints) { // byte offset of a run of ints in the cache, npos when absent
+        return pristine.find(std::string(reinterpret_cast<const char*>(ints.data()), ints.size() * sizeof(int)));
+    };
+    const int* vrt = reference.facet_vert_indices();
+    const std::size_t faces = find(std::vector<int>(vrt, vrt + 12));
+    const std::size_t lods = find({ 0, reference.nfaces(), 0, 0 }); // level 0, written before its meshlets were built
+    bool ok = pristine.size() > 0 && faces != std::string::npos && lods != std::string::npos;
+    for (const std::size_t at : { faces + 5 * sizeof(int), lods + sizeof(int) }) { // one vertex index, then the face count of level 0
+        if (!ok) break;
+        std::string corrupt = pristine;
+        const int bad = at == lods + sizeof(int) ? -3 : reference.nverts() + 1000;
+        std::memcpy(&corrupt[at], &bad, sizeof(int));
+        std::ofstream(cachefile, std::ios::binary).write(corrupt.data(), static_cast<std::streamsize>(corrupt.size()));
+        const Model loaded(path);
+        ok = reference.same_geometry(loaded) && check_meshlets(loaded);
+    }
+    std::filesystem::remove(path, ec);
+    std::filesystem::remove(cachefile, ec);
+    return ok;
+}
+
+// the instance hierarchy finds the same instances as a linear pass over their bounds, also after some of them moved,
+// and the id buffer names the instance that wrote each pixel
+static bool check_instances(const Model& model, const int size, int& picked) {
+    InstanceScene scene;
+    const int m = scene.add_model(model);
+    auto add_grid = [&scene, m](const int grid) { // the red channel of the material tells the instances apart
+        for (int i = 0; i < grid * grid; i++)
+            scene.add(m, translation_scale({ (2. * (i % grid) + 1) / grid - 1, (2. * (i / grid) + 1) / grid - 1, 0 }, 1. / grid), { { (i + 1.) / (grid * grid), 1, 1 } });
+    };
+    std::uint32_t seed = 1;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / double(1 << 24); }; // in [0, 1)
+
+    struct View { vec3 eye; double zoom; };
+    const View views[] = { { { 0, 0, 3 }, 1 }, { { 0, 0, 3 }, 4 }, { { -1, 0, 2 }, 3 }, { { 2, 1, 1 }, 6 } };
+    auto agree = [&]() {
+        std::vector<int> got, expected;
+        for (const View& v : views) {
+            Scene s;
+            s.eye = v.eye;
+            s.zoom = v.zoom;
+            setup_frame(s, size, size);
+            lookat(s.eye, { 0, 0, 0 }, { 0, 1, 0 });
+            const Frustum frustum = screen_frustum(Perspective * ModelView, Viewport, size, size);
+            scene.visible(frustum, got);
+            expected.clear();
+            for (int i = 0; i < static_cast<int>(scene.instances().size()); i++)
+                if (!frustum.culls(scene.instances()[i].bounds)) expected.push_back(i);
+            if (got != expected) return false;
+        }
+        return true;
+    };
+    add_grid(16);
+    bool ok = agree();
+    for (int i = 0; i < static_cast<int>(scene.instances().size()); i += 5) // refitted in place
+        scene.set_transform(i, translation_scale({ 3 * random() - 1.5, 3 * random() - 1.5, 2 * random() - 1 }, .3 * random() + .02));
+    ok = ok && agree();
+    scene.add(m, translation_scale({ 0, 0, 1 }, .3)); // rebuilt
+    ok = ok && agree();
+
+    scene.clear(); // heads large enough to keep most of their triangles
+    scene.add_model(model);
+    add_grid(4);
+    for (int i = 0; i < 16; i += 3) scene.set_transform(i, translation_scale({ 2 * random() - 1, 2 * random() - 1, random() }, .3 * random() + .1));
+    Scene s;
+    s.eye = { 0, 0, 3 };
+    set_id_buffer(true);
+    setup_frame(s, size, size);
+    lookat(s.eye, { 0, 0, 0 }, { 0, 1, 0 });
+    std::fill(zbuffer.begin(), zbuffer.end(), -std::numeric_limits<double>::max());
+    clear_debug_buffers();
+    RandomShader shader(model);
+    shader.color = { 255, 255, 255, 255 };
+    TGAImage frame(size, size, TGAImage::RGB);
+    draw(shader, scene, m, frame);
+    std::vector<int> seen;
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++) {
+            const int i = pick_instance(x, y);
+            const TGAColor c = frame.get(x, y);
+            if (i < 0) {
+                ok = ok && !c[0] && !c[1] && !c[2];
+                continue;
+            }
+            ok = ok && i < static_cast<int>(scene.instances().size()) &&
+                c[2] == static_cast<std::uint8_t>(255 * std::min(1., scene.instances()[i].material.color.x));
+            seen.push_back(i);
+        }
+    std::fill(zbuffer.begin(), zbuffer.end(), -std::numeric_limits<double>::max()); // a plain draw afterwards names no instance
+    clear_debug_buffers();
+    TGAImage plain(size, size, TGAImage::RGB);
+    draw(shader, model, plain);
+    int covered = 0;
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+            if (plain.get(x, y)[0]) {
+                covered++;
+                ok = ok && pick_instance(x, y) < 0;
+            }
+    ok = ok && covered > 0;
+    set_id_buffer(false);
+    std::sort(seen.begin(), seen.end());
+    picked = static_cast<int>(std::unique(seen.begin(), seen.end()) - seen.begin());
+    return ok && picked > 8;
+}
+
+// a model covering a few hundred pixels reads a few KB of its diffuse texture through the mip chain, not the base level
+static bool check_texture_footprint(const Model& model, const int size, std::size_t& footprint, std::uint64_t& fragments) {
+    InstanceScene scene;
+    scene.add(scene.add_model(model), translation_scale({ 0, 0, 0 }, .3));
+    Scene s;
+    s.eye = { 0, 0, 3 };
+    setup_frame(s, size, size);
+    lookat(s.eye, { 0, 0, 0 }, { 0, 1, 0 });
+    std::fill(zbuffer.begin(), zbuffer.end(), -std::numeric_limits<double>::max());
+    clear_debug_buffers();
+    TextureFootprint read(model.diffuse()); // the cached texture itself is left untouched
+    TexturedShader<TextureProbe> shader({ 1, 1, 1 }, model, TextureProbe{ &read });
+    TGAImage frame(size, size, TGAImage::RGB);
+    PipelineCounters::instance().end_frame(); // drops the counts of the previous frames
+    draw(shader, scene, 0, frame);
+    fragments = PipelineCounters::instance().end_frame()[Counter::FragmentsWritten];
+    footprint = read.bytes();
+    return fragments >= 100 && footprint <= 8 * 1024;
+}
+
+// the wrap modes address the texels like their definition, the SIMD bilinear filter matches a double precision reference
+// and the tiled and Morton layouts sample like the linear one, odd sizes and padding included
+static bool check_sampler() {
+    TGAImage img(4, 2, TGAImage::RGBA);
+    for (int y = 0; y < 2; y++)
+        for (int x = 0; x < 4; x++) img.set(x, y, { static_cast<std::uint8_t>(60 * x), static_cast<std::uint8_t>(200 * y), 7, 255 });
+    const Texture tex(img);
+    const Sampler<Wrap::Repeat> repeat(tex);
+    const Sampler<Wrap::Clamp> clamp(tex);
+    const Sampler<Wrap::Mirror> mirror(tex);
+    bool ok = true;
+    for (const double u : { -.125, 1.125, 1.875, -1.125 }) { // texels -1, 4, 7 and -5
+        const int x = static_cast<int>(std::floor(u * 4)), m = ((x % 8) + 8) % 8;
+        ok = ok && repeat.nearest({ u, .25 })[0] == 60 * (((x % 4) + 4) % 4);
+        ok = ok && clamp.nearest({ u, .25 })[0] == 60 * std::min(std::max(x, 0), 3);
+        ok = ok && mirror.nearest({ u, .25 })[0] == 60 * (m < 4 ? m : 7 - m);
+    }
+    std::uint32_t seed = 7;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / double(1 << 24); }; // in [0, 1)
+    for (int i = 0; i < 1000; i++) {
+        const vec2 uv = { random(), random() };
+        const double x = uv.x * 4 - .5, y = uv.y * 2 - .5, fx = std::floor(x), fy = std::floor(y), tx = x - fx, ty = y - fy;
+        auto texel = [&img](const int x, const int y) { return img.get(((x % 4) + 4) % 4, ((y % 2) + 2) % 2); };
+        const TGAColor c = repeat.bilinear(uv);
+        for (int k = 0; k < 4; k++) {
+            const double expected = (texel(int(fx), int(fy))[k] * (1 - tx) + texel(int(fx) + 1, int(fy))[k] * tx) * (1 - ty) +
+                (texel(int(fx), int(fy) + 1)[k] * (1 - tx) + texel(int(fx) + 1, int(fy) + 1)[k] * tx) * ty;
+            ok = ok && std::abs(c[k] - expected) <= .51;
+        }
+    }
+
+    TGAImage odd(37, 21, TGAImage::RGB);
+    for (int y = 0; y < odd.height(); y++)
+        for (int x = 0; x < odd.width(); x++)
+            odd.set(x, y, { static_cast<std::uint8_t>(random() * 256), static_cast<std::uint8_t>(random() * 256), static_cast<std::uint8_t>(random() * 256), 255 });
+    const Texture linear(odd);
+    for (const TextureLayout layout : { TextureLayout::Tiled4, TextureLayout::Tiled8, TextureLayout::Morton }) {
+        const Texture other(odd, layout);
+        const Sampler<Wrap::Mirror, Wrap::Repeat> a(linear), b(other);
+        for (int i = 0; i < 1000; i++) {
+            const vec2 uv = { 3 * random() - 1, 3 * random() - 1 };
+            const double lod = 6 * random();
+            const TGAColor c[6] = { a.nearest(uv), b.nearest(uv), a.bilinear(uv, i % linear.nlevels()), b.bilinear(uv, i % linear.nlevels()), a.trilinear(uv, lod), b.trilinear(uv, lod) };
+            for (int k = 0; k < 4; k++) ok = ok && c[0][k] == c[1][k] && c[2][k] == c[3][k] && c[4][k] == c[5][k];
+        }
+    }
+    return ok;
+}
+
+// both encodings of a normal map sample unit normals, float3 the decoded bytes normalized at load and octahedral, which
+// normalizes each decoded vector, within a small fraction of a degree of them
+static bool check_normal_map(const TGAImage& img, NormalMap& octahedral) {
+    const NormalMap float3(img, NormalEncoding::Float3);
+    octahedral = NormalMap(img, NormalEncoding::Octahedral);
+    bool ok = !float3.empty() && octahedral.max_error() < .1;
+    const int w = img.width(), h = img.height();
+    for (int y = 0; ok && y < h; y += 3)
+        for (int x = 0; x < w; x += 3) {
+            const vec2 uv = { (x + .5) / w, (y + .5) / h };
+            const TGAColor c = img.get(x, y);
+            const vec3 bytes = vec3{ static_cast<double>(c[2]), static_cast<double>(c[1]), static_cast<double>(c[0]) } * 2. / 255. - vec3{ 1, 1, 1 };
+            if (norm(bytes) == 0) continue;
+            const vec3 f = float3.sample(uv), o = octahedral.sample(uv);
+            ok = ok && std::abs(norm(f) - 1) < 1e-6 && std::abs(norm(o) - 1) < 1e-6;
+            ok = ok && norm(f - normalized(bytes)) < 1e-6 && norm(o - f) < 2 * std::sin(.1 * 3.14159265358979323846 / 360);
+        }
+    return ok;
+}
+
+// the cache hands out the same texture for the same file, in each layout, loads it again once the file changed and evicts
+// the least recently used entries over the budget
+static bool check_asset_cache() {
+    AssetCache& assets = AssetCache::instance();
+    const std::string file = (std::filesystem::temp_directory_path() / "tinyrenderer_asset_cache.tga").string();
+    TGAImage img(16, 16, TGAImage::RGB);
+    for (int y = 0; y < 16; y++)
+        for (int x = 0; x < 16; x++) img.set(x, y, { static_cast<std::uint8_t>(16 * x), static_cast<std::uint8_t>(16 * y), 0, 255 });
+    if (!img.write_tga_file(file, false)) return false;
+    const AssetStats before = assets.stats();
+    const std::shared_ptr<const Texture> a = assets.texture(file), b = assets.texture(file);
+    const std::shared_ptr<const Texture> tiled = assets.texture(file, TextureLayout::Tiled4);
+    bool ok = a && a == b && tiled && tiled != a && tiled->layout() == TextureLayout::Tiled4;
+    ok = ok && assets.stats().hits == before.hits + 2 && assets.stats().misses == before.misses + 2; // the tiled one reuses the linear one
+    for (int i = 0; ok && i < 64; i++) {
+        const vec2 uv = { (i % 8 + .5) / 8, (i / 8 + .5) / 8 };
+        const TGAColor c = a->sample_nearest(uv), d = tiled->sample_nearest(uv);
+        ok = ok && c[0] == d[0] && c[1] == d[1] && c[2] == d[2];
+    }
+
+    TGAImage bigger(32, 16, TGAImage::RGB);
+    ok = ok && bigger.write_tga_file(file, false);
+    const std::shared_ptr<const Texture> changed = assets.texture(file);
+    ok = ok && changed && changed != a && changed->width() == 32;
+
+    const AssetStats full = assets.stats();
+    assets.set_budget(changed->bytes());
+    const AssetStats trimmed = assets.stats();
+    ok = ok && trimmed.bytes <= changed->bytes() && trimmed.evictions + trimmed.entries == full.evictions + full.entries;
+    ok = ok && assets.texture(file) == changed && a->width() == 16; // still in the cache, the evicted ones stay valid for their holders
+    assets.set_budget(full.budget);
+    std::filesystem::remove(file);
+    return ok;
+}
+
+static bool same_pixels(const TGAImage& a, const TGAImage& b) {
+    bool ok = a.width() == b.width() && a.height() == b.height() && a.bytespp() == b.bytespp();
+    for (int y = 0; ok && y < a.height(); y++)
+        for (int x = 0; x < a.width(); x++)
+            for (int k = 0; k < a.bytespp(); k++) ok = ok && a.get(x, y)[k] == b.get(x, y)[k];
+    return ok;
+}
+
+// uncompressed files of either orientation read as views into the file with the pixels they were written with, a copy
+// written to is detached from the view, and a view writes back the same pixels
+static bool check_tga_views(bool& mapped) {
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::string file = (dir / "tinyrenderer_view.tga").string(), copy = (dir / "tinyrenderer_view_copy.tga").string();
+    TGAImage img(37, 23, TGAImage::RGBA);
+    for (int y = 0; y < img.height(); y++)
+        for (int x = 0; x < img.width(); x++) img.set(x, y, { static_cast<std::uint8_t>(7 * x), static_cast<std::uint8_t>(11 * y), static_cast<std::uint8_t>(x ^ y), 255 });
+    bool ok = true;
+    mapped = true;
+    for (const bool vflip : { true, false }) { // the views of an iteration are released before the files are written again
+        TGAImage view;
+        ok = img.write_tga_file(file, vflip, false) && view.read_tga_file(file) && ok;
+        mapped = mapped && view.mapped();
+        TGAImage expected = img;
+        if (vflip) expected.flip_vertically(); // the rows of the framebuffer go up
+        ok = ok && same_pixels(view, expected);
+        TGAImage edited = view, back;
+        edited.set(0, 0, { 1, 2, 3, 4 });
+        ok = ok && !edited.mapped() && edited.get(0, 0)[0] == 1 && view.get(0, 0)[0] == expected.get(0, 0)[0];
+        ok = ok && view.write_tga_file(copy, false, false) && back.read_tga_file(copy) && same_pixels(view, back);
+    }
+    std::filesystem::remove(file);
+    std::filesystem::remove(copy);
+    return ok;
+}
+
+// RLE files of every pixel size decode to the pixels written, runs and raw packets crossing rows, and a truncated one is rejected
+static bool check_tga_rle() {
+    const std::string file = (std::filesystem::temp_directory_path() / "tinyrenderer_rle.tga").string();
+    bool ok = true;
+    for (const int bpp : { TGAImage::GRAYSCALE, TGAImage::RGB, TGAImage::RGBA }) {
+        TGAImage img(45, 19, bpp), back;
+        for (int y = 0; y < img.height(); y++)
+            for (int x = 0; x < img.width(); x++) {
+                const std::uint8_t v = static_cast<std::uint8_t>((x + y * 45) / 200 % 2 ? x * 37 + y : (x + y * 45) / 100); // runs and noise
+                img.set(x, y, { v, static_cast<std::uint8_t>(v + 1), static_cast<std::uint8_t>(v * 3), 255 });
+            }
+        ok = ok && img.write_tga_file(file, true, true) && back.read_tga_file(file);
+        if (ok) back.flip_vertically();
+        ok = ok && same_pixels(img, back);
+    }
+    std::filesystem::resize_file(file, std::filesystem::file_size(file) - 100); // the footer and the last packets
+    TGAImage truncated;
+    ok = ok && !truncated.read_tga_file(file);
+    std::filesystem::remove(file);
+    return ok;
+}
+
+// the background writer writes every frame submitted through a small queue, in any pixel size, and counts the failures
+static bool check_frame_writer() {
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    std::vector<TGAImage> frames;
+    for (int i = 0; i < 6; i++) {
+        frames.emplace_back(33 + i, 70, i % 2 ? TGAImage::RGBA : TGAImage::RGB);
+        for (int y = 0; y < 70; y++)
+            for (int x = 0; x < 33 + i; x++) frames.back().set(x, y, { static_cast<std::uint8_t>(y / 3 * i), static_cast<std::uint8_t>(x / 4), 9, 255 });
+    }
+    auto name = [&dir](const int i) { return (dir / ("tinyrenderer_frame_" + std::to_string(i) + ".tga")).string(); };
+    int written = 0, failed = 0;
+    {
+        FrameWriter writer(2);
+        for (int i = 0; i < 6; i++) writer.submit(name(i), frames[i], false);
+        writer.submit((dir / "no_such_directory" / "frame.tga").string(), frames[0]);
+        writer.flush();
+        written = writer.written();
+        failed = writer.failed();
+    }
+    bool ok = written == 6 && failed == 1;
+    for (int i = 0; i < 6; i++) {
+        TGAImage back;
+        ok = ok && back.read_tga_file(name(i)) && same_pixels(frames[i], back);
+        std::filesystem::remove(name(i));
+    }
+    return ok;
+}
+
+// the QOI and PPM frame dumps read back to the pixels written, in both orientations, and a truncated QOI file is rejected
+static bool check_frame_formats() {
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    std::uint32_t seed = 3;
+    auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return static_cast<std::uint8_t>(seed >> 24); };
+    bool ok = true;
+    for (const int bpp : { TGAImage::GRAYSCALE, TGAImage::RGB, TGAImage::RGBA }) {
+        TGAImage img(61, 29, bpp);
+        for (int y = 0; y < img.height(); y++)
+            for (int x = 0; x < img.width(); x++) { // flat areas, gradients and noise reach every QOI operation
+                const std::uint8_t v = y < 10 ? 40 : y < 20 ? static_cast<std::uint8_t>(x * 2 + y) : random();
+                img.set(x, y, { v, static_cast<std::uint8_t>(v + x % 3), y < 20 ? v : random(), static_cast<std::uint8_t>(x < 50 ? 255 : random()) });
+            }
+        for (const char* ext : { ".qoi", ".ppm", ".tga" }) {
+            if (std::string(ext) == ".ppm" && bpp == TGAImage::RGBA) continue; // no alpha
+            if (std::string(ext) == ".qoi" && bpp == TGAImage::GRAYSCALE) continue; // read back as RGB
+            const std::string file = (dir / (std::string("tinyrenderer_format") + ext)).string();
+            for (const bool vflip : { true, false }) {
+                TGAImage back, expected = img;
+                if (vflip) expected.flip_vertically();
+                ok = ok && img.write_file(file, vflip) && back.read_file(file) && same_pixels(expected, back);
+            }
+            std::filesystem::remove(file);
+        }
+    }
+    TGAImage img(64, 64, TGAImage::RGB), back;
+    for (int y = 0; y < 64; y++)
+        for (int x = 0; x < 64; x++) img.set(x, y, { random(), random(), random(), 255 });
+    std::vector<std::uint8_t> bytes = img.encode_qoi();
+    bytes.resize(bytes.size() - 100);
+    const std::string file = (dir / "tinyrenderer_truncated.qoi").string();
+    std::ofstream(file, std::ios::binary).write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    ok = ok && !back.read_file(file);
+    std::filesystem::remove(file);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_options(argc, argv, opt)) return 1;
+
+    struct Camera { const char* name; vec3 eye; double zoom; };
+    const Camera cameras[] = { { "front", { 0, 0, 3 }, 1 }, { "side", { -1, 0, 2 }, 1 }, { "zoom", { -1, 0, 2 }, 3 } };
+    const ShaderKind shaders[] = { ShaderKind::Random, ShaderKind::Phong, ShaderKind::Depth, ShaderKind::Textured };
+
+    std::map<std::string, double> baseline = read_baseline(opt.baseline), timings;
+    int failures = 0, checks = 0;
+    const double lod_default = lod_threshold();
+    set_lod_threshold(0);
+    auto report = [&checks, &failures](const bool ok, const std::string& detail) { // one line per check, counted
+        checks++;
+        std::cerr << (ok ? "ok   " : "FAIL ") << detail << "\n";
+        if (!ok) failures++;
+    };
+    {
+        int picked = 0;
+        const std::shared_ptr<const Model> loaded = AssetCache::instance().model(opt.assets + "/african_head/african_head.obj");
+        const Model& head = *loaded;
+        bool ok = check_corrupt_mesh_cache(opt.assets + "/african_head/african_head_eye_inner.obj");
+        report(ok, text("mesh cache: corrupt face indices and LOD levels ", ok ? "are rejected and regenerated" : "are accepted"));
+        ok = check_instances(head, opt.size, picked);
+        report(ok, text("instances: hierarchy culling ", ok ? "matches" : "does not match", " the linear pass, ", picked, " instances picked"));
+        std::size_t footprint = 0;
+        std::uint64_t fragments = 0;
+        ok = check_texture_footprint(head, opt.size, footprint, fragments);
+        report(ok, text("textures: ", fragments, " fragments read ", footprint / 1024., " KB of the ", head.diffuse().width(), "x", head.diffuse().height(),
+            " diffuse texture, ", head.diffuse().bytes() / 1024, " KB with its mip chain"));
+        ok = check_sampler();
+        report(ok, text("textures: wrap modes, bilinear filter and layouts ", ok ? "agree" : "disagree", " with the reference"));
+        TGAImage nm;
+        NormalMap octahedral;
+        ok = nm.read_tga_file((opt.assets + "/african_head/african_head_nm_tangent.tga").c_str()) && check_normal_map(nm, octahedral);
+        report(ok, text("normal maps: ", nm.width(), "x", nm.height(), " in ", head.tangent_normals().bytes() / 1024, " KB as float3, ",
+            octahedral.bytes() / 1024, " KB as octahedral, ", octahedral.max_error(), " degrees at most apart"));
+        bool mapped = false;
+        ok = check_tga_views(mapped);
+        report(ok, text("tga: uncompressed files read in place ", mapped ? "from a mapping" : "from memory", ", both orientations ",
+            ok ? "match" : "do not match", " the pixels written"));
+        ok = check_tga_rle();
+        report(ok, text("tga: RLE files ", ok ? "decode" : "do not decode", " to the pixels written"));
+        ok = check_frame_writer();
+        report(ok, text("tga: the background writer ", ok ? "wrote" : "did not write", " every frame"));
+        ok = check_frame_formats();
+        report(ok, text("frames: QOI and PPM files ", ok ? "read back" : "do not read back", " to the pixels written"));
+        const std::string head_file = opt.assets + "/african_head/african_head.obj";
+        const std::shared_ptr<const Model> streamed = AssetCache::instance().model(head_file, ObjLoader::Stream); // an entry of its own
+        ok = AssetCache::instance().model(head_file) == loaded && streamed && streamed != loaded && check_asset_cache();
+        const AssetStats stats = AssetCache::instance().stats();
+        report(ok, text("asset cache: ", stats.entries, " entries in ", stats.bytes / 1024, " KB, ", stats.hits, " hits, ", stats.misses, " misses, ",
+            stats.evictions, " evictions"));
+    }
+    for (Scene scene : standard_scenes(2)) {
+        std::vector<std::unique_ptr<Model>> models;
+        if (!load_scene(scene, opt.assets, models)) {
+            std::cerr << "FAIL " << scene.name << ": can't load the scene\n";
+            failures++;
+            continue;
+        }
+        for (const std::string& f : scene.files) { // the parallel parser and the mesh cache must reproduce the stream parser bit for bit
+            const std::string path = opt.assets + "/" + f;
+            const Model reference(path, ObjLoader::Stream), cached(path); // load_scene has just written or validated the cache
+            bool ok = reference.same_geometry(Model(path, ObjLoader::Parallel)) && reference.same_geometry(cached);
+            report(ok, text(f, ": parsers and mesh cache ", ok ? "agree" : "disagree"));
+            ok = check_meshlets(cached);
+            report(ok, text(f, ": ", cached.lods().size(), " LOD levels, ", cached.meshlets().size(), " meshlets", ok ? "" : ", not a partition of the triangles"));
+        }
+        for (const Camera& camera : cameras) {
+            scene.eye = camera.eye;
+            scene.zoom = camera.zoom;
+            for (const ShaderKind kind : shaders) {
+                const std::string name = scene.name + "_" + camera.name + "_" + shader_name(kind);
+                const std::string golden_file = opt.golden + "/" + name + ".tga";
+                TGAImage frame(opt.size, opt.size, TGAImage::RGB);
+                setup_frame(scene, opt.size, opt.size);
+                render_frame(scene, models, kind, frame);
+                std::vector<double> ms;
+                for (int i = 0; i < opt.reps; i++) {
+                    auto start = std::chrono::steady_clock::now();
+                    render_frame(scene, models, kind, frame);
+                    ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                }
+                timings[name] = *std::min_element(ms.begin(), ms.end());
+
+                checks++;
+                if (opt.update) {
+                    if (!frame.write_tga_file(golden_file, false)) failures++; // top-left origin: read back without flipping
+                    continue;
+                }
+                if (!check_image(opt, name, golden_file, frame)) failures++;
+            }
+        }
+
+        if (opt.update) continue;
+        set_lod_threshold(lod_default); // the simplified levels stay close to the full meshes, silhouettes and per-face colors aside
+        Options lod_opt = opt;
+        lod_opt.min_psnr = opt.lod_psnr;
+        lod_opt.max_bad = 1;
+        for (const Camera& camera : cameras) {
+            scene.eye = camera.eye;
+            scene.zoom = camera.zoom;
+            const std::string name = scene.name + "_" + camera.name + "_" + shader_name(ShaderKind::Phong);
+            TGAImage frame(opt.size, opt.size, TGAImage::RGB);
+            setup_frame(scene, opt.size, opt.size);
+            PipelineCounters::instance().end_frame(); // drops the counts of the previous frames
+            render_frame(scene, models, ShaderKind::Phong, frame);
+            const FrameCounters& counters = PipelineCounters::instance().end_frame();
+            std::cerr << "     " << name << "_lod: " << counters[Counter::TrianglesLodSaved] << " triangles saved\n";
+            checks++;
+            if (!check_image(lod_opt, name + "_lod", opt.golden + "/" + name + ".tga", frame)) failures++;
+        }
+        set_lod_threshold(0);
+
+        struct Storage { const char* name; VertexStorage storage; };
+        for (const Storage& s : { Storage{ "float32", VertexStorage::Float32 }, Storage{ "quantized", VertexStorage::Quantized } }) {
+            for (auto& m : models) m->set_storage(s.storage); // the compact storages must render like the doubles
+            for (const ShaderKind kind : shaders) {
+                scene.eye = cameras[0].eye;
+                scene.zoom = cameras[0].zoom;
+                const std::string name = scene.name + "_" + cameras[0].name + "_" + shader_name(kind);
+                TGAImage frame(opt.size, opt.size, TGAImage::RGB);
+                setup_frame(scene, opt.size, opt.size);
+                render_frame(scene, models, kind, frame);
+                checks++;
+                if (!check_image(opt, name + "_" + s.name, opt.golden + "/" + name + ".tga", frame)) failures++;
+            }
+        }
+    }
+
+    if (opt.update) {
+        std::ofstream out(opt.baseline);
+        for (const auto& t : timings) out << t.first << " " << t.second << "\n";
+        std::cerr << "updated " << checks << " golden images and " << opt.baseline << "\n";
+    }
+    else if (opt.timing) {
+        for (const auto& t : timings) {
+            auto b = baseline.find(t.first);
+            if (b == baseline.end()) {
+                std::cerr << "skip " << t.first << ": no baseline timing\n";
+                continue;
+            }
+            report(t.second <= b->second * (1. + opt.slack), text(t.first, ": ", t.second, " ms, baseline ", b->second, " ms"));
+        }
+    }
+    std::cerr << checks - failures << "/" << checks << " checks passed\n";
+    return failures ? 1 : 0;
+}
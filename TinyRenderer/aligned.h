@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TR_SSE2 1 // SIMD code paths, every function using them has a scalar fallback
+#endif
+
+constexpr std::size_t kSimdAlignment = 64; // cache line, enough for any SSE/AVX/AVX-512 load
+constexpr std::size_t kSimdWidth = 16;     // aligned arrays are padded to a multiple of this many elements
+
+template <typename T, std::size_t Align = kSimdAlignment> struct AlignedAllocator {
+    using value_type = T;
+    template <typename U> struct rebind { using other = AlignedAllocator<U, Align>; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+    T* allocate(const std::size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align))); }
+    void deallocate(T* p, const std::size_t) { ::operator delete(p, std::align_val_t(Align)); }
+};
+
+template <typename T, typename U, std::size_t Align>
+bool operator==(const AlignedAllocator<T, Align>&, const AlignedAllocator<U, Align>&) { return true; }
+template <typename T, typename U, std::size_t Align>
+bool operator!=(const AlignedAllocator<T, Align>&, const AlignedAllocator<U, Align>&) { return false; }
+
+template <typename T> using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+inline std::size_t simd_padded(const std::size_t n) { return (n + kSimdWidth - 1) / kSimdWidth * kSimdWidth; }
@@ -0,0 +1,129 @@
+#include <filesystem>
+#include <iostream>
+#include "asset_cache.h"
+
+namespace {
+    bool file_key(const char* kind, const std::string& filename, std::string& key) { // false when the file does not exist
+        std::error_code ec;
+        const std::filesystem::path path = std::filesystem::canonical(filename, ec);
+        if (ec) return false;
+        const std::uintmax_t size = std::filesystem::file_size(path, ec);
+        if (ec) return false;
+        const auto stamp = std::filesystem::last_write_time(path, ec);
+        if (ec) return false;
+        key = std::string(kind) + "|" + path.string() + "|" + std::to_string(size) + "|" + std::to_string(stamp.time_since_epoch().count());
+        return true;
+    }
+
+    std::size_t asset_bytes(const Texture& t) { return t.bytes(); }
+    std::size_t asset_bytes(const NormalMap& n) { return n.bytes(); }
+    std::size_t asset_bytes(const Model& m) { return m.geometry_bytes(); }
+}
+
+AssetCache& AssetCache::instance() {
+    static AssetCache cache;
+    return cache;
+}
+
+template <typename T, typename Load> std::shared_ptr<const T> AssetCache::get(const std::string& key, Load load) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        const auto it = index.find(key);
+        if (it != index.end()) {
+            hit_count++;
+            lru.splice(lru.begin(), lru, it->second);
+            return std::static_pointer_cast<const T>(it->second->asset);
+        }
+        miss_count++;
+    }
+    std::shared_ptr<const T> asset = load();
+    if (!asset) return nullptr;
+    std::lock_guard<std::mutex> guard(lock);
+    const auto it = index.find(key);
+    if (it != index.end()) { // loaded meanwhile by another thread
+        lru.splice(lru.begin(), lru, it->second);
+        return std::static_pointer_cast<const T>(it->second->asset);
+    }
+    lru.push_front({ key, asset, asset_bytes(*asset) });
+    index[key] = lru.begin();
+    used += lru.front().bytes;
+    evict();
+    return asset;
+}
+
+std::shared_ptr<const Texture> AssetCache::texture(const std::string filename, const TextureLayout layout) {
+    std::string key;
+    if (!file_key("texture", filename, key)) return nullptr;
+    key += "|" + std::to_string(static_cast<int>(layout));
+    return get<Texture>(key, [this, &filename, layout]() -> std::shared_ptr<const Texture> {
+        if (layout != TextureLayout::Linear) { // reordered from the linear one rather than decoded again
+            const std::shared_ptr<const Texture> linear = texture(filename, TextureLayout::Linear);
+            return linear ? std::make_shared<const Texture>(*linear, layout) : nullptr;
+        }
+        TGAImage img;
+        if (!img.read_tga_file(filename.c_str())) return nullptr;
+        return std::make_shared<const Texture>(img);
+        });
+}
+
+std::shared_ptr<const NormalMap> AssetCache::normal_map(const std::string filename, const NormalEncoding encoding) {
+    std::string key;
+    if (!file_key("normals", filename, key)) return nullptr;
+    key += "|" + std::to_string(static_cast<int>(encoding));
+    return get<NormalMap>(key, [this, &filename, encoding]() -> std::shared_ptr<const NormalMap> {
+        if (encoding != NormalEncoding::Float3) { // encoded from the float3 one rather than decoded again
+            const std::shared_ptr<const NormalMap> float3 = normal_map(filename, NormalEncoding::Float3);
+            if (!float3) return nullptr;
+            auto ret = std::make_shared<NormalMap>(*float3);
+            ret->set_encoding(encoding);
+            return ret;
+        }
+        TGAImage img;
+        if (!img.read_tga_file(filename.c_str())) return nullptr;
+        return std::make_shared<const NormalMap>(img, encoding);
+        });
+}
+
+std::shared_ptr<const Model> AssetCache::model(const std::string filename, const ObjLoader loader) {
+    std::string key;
+    if (!file_key("model", filename, key)) {
+        std::cerr << "can not open " << filename << std::endl;
+        return nullptr;
+    }
+    key += "|" + std::to_string(static_cast<int>(loader));
+    return get<Model>(key, [&filename, loader]() { return std::make_shared<const Model>(filename, loader); });
+}
+
+void AssetCache::evict() {
+    while (used > limit && !lru.empty()) {
+        used -= lru.back().bytes;
+        index.erase(lru.back().key);
+        lru.pop_back();
+        evict_count++;
+    }
+}
+
+void AssetCache::set_budget(const std::size_t bytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    limit = bytes;
+    evict();
+}
+
+AssetStats AssetCache::stats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    AssetStats ret;
+    ret.hits = hit_count;
+    ret.misses = miss_count;
+    ret.evictions = evict_count;
+    ret.bytes = used;
+    ret.budget = limit;
+    ret.entries = static_cast<int>(lru.size());
+    return ret;
+}
+
+void AssetCache::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    lru.clear();
+    index.clear();
+    used = 0;
+}
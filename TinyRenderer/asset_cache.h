@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "model.h"
+#include "normal_map.h"
+#include "texture.h"
+
+struct AssetStats {
+    std::uint64_t hits = 0, misses = 0, evictions = 0;
+    std::size_t bytes = 0;  // held by the cache, the assets still used elsewhere after their eviction are not counted
+    std::size_t budget = 0;
+    int entries = 0;
+};
+
+// Process-wide cache of the decoded textures, normal maps and models, keyed by canonical path, file size and modification
+// time, and by the in-memory format or the loader. The assets are handed out shared and immutable: loading the same file twice returns
+// the same object, and a file changed on disk is loaded again. Over the budget the least recently used entries are
+// evicted, which only drops the reference of the cache. The loads run outside of the lock, two threads missing the same
+// entry at once both load it and the first one inserted is kept.
+class AssetCache {
+public:
+    static AssetCache& instance();
+
+    std::shared_ptr<const Texture> texture(const std::string filename, const TextureLayout layout = TextureLayout::Linear); // nullptr when unreadable
+    std::shared_ptr<const NormalMap> normal_map(const std::string filename, const NormalEncoding encoding = NormalEncoding::Float3);
+    std::shared_ptr<const Model> model(const std::string filename, const ObjLoader loader = ObjLoader::Cache); // its geometry counts against the budget, its textures are entries of their own
+
+    void set_budget(const std::size_t bytes); // evicts down to it
+    AssetStats stats() const;
+    void clear();                             // drops every entry, the statistics stay
+private:
+    AssetCache() = default;
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const void> asset;
+        std::size_t bytes = 0;
+    };
+    template <typename T, typename Load> std::shared_ptr<const T> get(const std::string& key, Load load);
+    void evict(); // the lock held
+
+    mutable std::mutex lock;
+    std::list<Entry> lru = {}; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index = {};
+    std::size_t used = 0, limit = std::size_t(512) << 20;
+    std::uint64_t hit_count = 0, miss_count = 0, evict_count = 0;
+};
@@ -0,0 +1,63 @@
+#include <iostream>
+#include <sstream>
+#include "counters.h"
+
+PipelineCounters& PipelineCounters::instance() {
+    static PipelineCounters counters;
+    return counters;
+}
+
+const FrameCounters& PipelineCounters::end_frame() {
+    FrameCounters frame = {};
+    frame.frame = total.frame; // total.frame counts the completed frames
+    for (int t = 0; t < kMaxThreads; t++)
+        for (int c = 0; c < kCounterCount; c++)
+            frame.value[c] += slots[t].value[c].exchange(0, std::memory_order_relaxed);
+    for (int c = 0; c < kCounterCount; c++)
+        total.value[c] += frame.value[c];
+    total.frame++;
+    last = frame;
+    if (log.is_open()) log << last.to_json() << "\n";
+    return last;
+}
+
+bool PipelineCounters::open_log(const std::string filename) {
+    log.open(filename, std::ios::out | std::ios::trunc);
+    if (!log.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    return true;
+}
+
+const char* PipelineCounters::name(const Counter c) {
+    switch (c) {
+    case Counter::VerticesShaded:          return "vertices_shaded";
+    case Counter::TrianglesLodSaved:       return "triangles_lod_saved";
+    case Counter::TrianglesFrustumCulled:  return "triangles_frustum_culled";
+    case Counter::InstancesFrustumCulled:  return "instances_frustum_culled";
+    case Counter::MeshletsFrustumCulled:   return "meshlets_frustum_culled";
+    case Counter::MeshletsBackfaceCulled:  return "meshlets_backface_culled";
+    case Counter::TrianglesSubmitted:      return "triangles_submitted";
+    case Counter::TrianglesBackfaceCulled: return "triangles_backface_culled";
+    case Counter::TrianglesTooSmall:       return "triangles_too_small";
+    case Counter::TrianglesClipped:        return "triangles_clipped";
+    case Counter::TrianglesRasterized:     return "triangles_rasterized";
+    case Counter::FragmentsTested:         return "fragments_tested";
+    case Counter::FragmentsDepthRejected:  return "fragments_depth_rejected";
+    case Counter::FragmentsDiscarded:      return "fragments_discarded";
+    case Counter::FragmentsWritten:        return "fragments_written";
+    case Counter::TexelsFetched:           return "texels_fetched";
+    case Counter::TextureCacheMisses:      return "texture_cache_misses";
+    default:                               return "?";
+    }
+}
+
+std::string FrameCounters::to_json() const {
+    std::ostringstream out;
+    out << "{\"frame\":" << frame;
+    for (int c = 0; c < kCounterCount; c++)
+        out << ",\"" << PipelineCounters::name(static_cast<Counter>(c)) << "\":" << value[c];
+    out << "}";
+    return out.str();
+}
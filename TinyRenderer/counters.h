@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "profiler.h"
+
+enum class Counter { // pipeline events counted per frame
+    VerticesShaded,           // vertex shader invocations, or positions transformed by the batched vertex stage
+    TrianglesLodSaved,        // triangles of the full mesh minus those of the LOD level drawn instead
+    TrianglesFrustumCulled,   // all three corners outside of the same screen border, dropped before rasterize()
+    InstancesFrustumCulled,   // instances whose world bounds are off screen, their triangles count as frustum culled
+    MeshletsFrustumCulled,    // meshlets whose bounds are off screen, their triangles count as frustum culled
+    MeshletsBackfaceCulled,   // meshlets whose normal cone faces away from the eye, their triangles count as backface culled
+    TrianglesSubmitted,       // triangles handed to rasterize()
+    TrianglesBackfaceCulled,  // negative screen-space area, or part of a back-facing meshlet
+    TrianglesTooSmall,        // 0 <= det < 1, i.e. covering less than a pixel
+    TrianglesClipped,         // bounding box crossing the screen border
+    TrianglesRasterized,      // triangles with at least one pixel of bounding box on screen
+    FragmentsTested,          // pixels inside a triangle reaching the depth test
+    FragmentsDepthRejected,   // fragments failing the depth test
+    FragmentsDiscarded,       // fragments discarded by the fragment shader
+    FragmentsWritten,         // fragments written to the framebuffer
+    TexelsFetched,            // texture reads, counted only while set_texture_cache_simulation() is on
+    TextureCacheMisses,       // of these, the ones missing the simulated texture cache
+    Count
+};
+constexpr int kCounterCount = static_cast<int>(Counter::Count);
+
+struct FrameCounters {
+    std::uint64_t frame = 0;
+    std::uint64_t value[kCounterCount] = {};
+    std::uint64_t operator[](const Counter c) const { return value[static_cast<int>(c)]; }
+    std::string to_json() const;
+};
+
+class PipelineCounters {
+public:
+    static PipelineCounters& instance();
+
+    void add(const Counter c, const std::uint64_t n = 1) { // owner thread only touches its own cache line
+        slots[thread_slot()].value[static_cast<int>(c)].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    const FrameCounters& end_frame(); // folds the per-thread accumulators into a frame snapshot, call once per frame
+    const FrameCounters& last_frame() const { return last; }   // counts of the last completed frame
+    const FrameCounters& totals() const { return total; }      // counts accumulated since the start
+    bool open_log(const std::string filename);                  // JSON lines, one object per completed frame
+    static const char* name(const Counter c);
+private:
+    PipelineCounters() = default;
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> value[kCounterCount] = {};
+    };
+    Slot slots[kMaxThreads];
+    FrameCounters last = {}, total = {};
+    std::ofstream log;
+};
@@ -0,0 +1,63 @@
+#include <chrono>
+#include "frame_writer.h"
+
+FrameWriter::FrameWriter(const std::size_t capacity) : limit(capacity ? capacity : 1), worker(&FrameWriter::run, this) {}
+
+FrameWriter::~FrameWriter() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    has_job.notify_one();
+    worker.join();
+}
+
+void FrameWriter::submit(const std::string filename, TGAImage frame, const bool vflip, const bool rle) {
+    std::unique_lock<std::mutex> guard(lock);
+    if (queue.size() >= limit) {
+        const auto start = std::chrono::steady_clock::now();
+        has_room.wait(guard, [this] { return queue.size() < limit; });
+        blocked += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    queue.push_back({ filename, std::move(frame), vflip, rle });
+    guard.unlock();
+    has_job.notify_one();
+}
+
+void FrameWriter::flush() {
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this] { return queue.empty() && !busy; });
+}
+
+int FrameWriter::written() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return nwritten;
+}
+
+int FrameWriter::failed() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return nfailed;
+}
+
+double FrameWriter::blocked_ms() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return blocked;
+}
+
+void FrameWriter::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        has_job.wait(guard, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) return; // stopping, and every frame written
+        Job job = std::move(queue.front());
+        queue.pop_front();
+        busy = true;
+        guard.unlock();
+        has_room.notify_one();
+        const bool ok = job.frame.write_file(job.filename, job.vflip, job.rle);
+        guard.lock();
+        busy = false;
+        (ok ? nwritten : nfailed)++;
+        if (queue.empty()) done.notify_all();
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "tgaimage.h"
+
+// Writes frames to image files on a background thread, so that the render loop waits neither for the encoder nor for the
+// disk. At most capacity frames wait in the queue: submit() blocks while it is full, which bounds the memory held when
+// the frames are rendered faster than they are written.
+class FrameWriter {
+public:
+    explicit FrameWriter(const std::size_t capacity = 4);
+    ~FrameWriter(); // writes the frames still queued
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    void submit(const std::string filename, TGAImage frame, const bool vflip = true, const bool rle = true); // see TGAImage::write_file()
+    void flush();              // waits until every submitted frame is written
+    int written() const;       // frames written so far
+    int failed() const;        // frames whose file could not be written
+    double blocked_ms() const; // time spent by submit() waiting for room in the queue
+private:
+    struct Job {
+        std::string filename;
+        TGAImage frame;
+        bool vflip = true, rle = true;
+    };
+    void run();
+
+    mutable std::mutex lock;
+    std::condition_variable has_job, has_room, done;
+    std::deque<Job> queue = {};
+    const std::size_t limit;
+    bool busy = false;     // a job taken off the queue is being written
+    bool stopping = false; // set by the destructor
+    int nwritten = 0, nfailed = 0;
+    double blocked = 0;
+    std::thread worker; // last, started once the other members are ready
+};
@@ -2,185 +2,303 @@
 #include <cmath>
 #include <cassert>
 #include <iostream>
+#include "aligned.h"
 
-template<int n> struct vec {
-    double data[n] = { 0 };
-    double& operator[](const int i) { assert(i >= 0 && i < n); return data[i]; }
-    double  operator[](const int i) const { assert(i >= 0 && i < n); return data[i]; }
+template<typename T> struct scalar_arg { using type = T; }; // keeps the scalar operands out of template argument deduction,
+template<typename T> using scalar_t = typename scalar_arg<T>::type; // so that vec3*2 or mat/3 still compile for any T
+
+template<int n, typename T = double> struct vec {
+    T data[n] = { 0 };
+    T& operator[](const int i) { assert(i >= 0 && i < n); return data[i]; }
+    T  operator[](const int i) const { assert(i >= 0 && i < n); return data[i]; }
 };
 
-template<int n> double operator*(const vec<n>& lhs, const vec<n>& rhs) {
-    double ret = 0;                         // N.B. Do not ever, ever use such for loops! They are highly confusing.
+template<int n, typename T> T operator*(const vec<n, T>& lhs, const vec<n, T>& rhs) {
+    T ret = 0;                              // N.B. Do not ever, ever use such for loops! They are highly confusing.
     for (int i = n; i--; ret += lhs[i] * rhs[i]); // Here I used them as a tribute to old-school game programmers fighting for every CPU cycle.
     return ret;                             // Once upon a time reverse loops were faster than the normal ones, it is not the case anymore.
 }
 
-template<int n> vec<n> operator+(const vec<n>& lhs, const vec<n>& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> vec<n, T> operator+(const vec<n, T>& lhs, const vec<n, T>& rhs) {
+    vec<n, T> ret = lhs;
     for (int i = n; i--; ret[i] += rhs[i]);
     return ret;
 }
 
-template<int n> vec<n> operator-(const vec<n>& lhs, const vec<n>& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> vec<n, T> operator-(const vec<n, T>& lhs, const vec<n, T>& rhs) {
+    vec<n, T> ret = lhs;
     for (int i = n; i--; ret[i] -= rhs[i]);
     return ret;
 }
 
-template<int n> vec<n> operator*(const vec<n>& lhs, const double& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> vec<n, T> operator*(const vec<n, T>& lhs, const scalar_t<T>& rhs) {
+    vec<n, T> ret = lhs;
     for (int i = n; i--; ret[i] *= rhs);
     return ret;
 }
 
-template<int n> vec<n> operator*(const double& lhs, const vec<n>& rhs) {
+template<int n, typename T> vec<n, T> operator*(const scalar_t<T>& lhs, const vec<n, T>& rhs) {
     return rhs * lhs;
 }
 
-template<int n> vec<n> operator/(const vec<n>& lhs, const double& rhs) {
-    vec<n> ret = lhs;
+template<int n, typename T> vec<n, T> operator/(const vec<n, T>& lhs, const scalar_t<T>& rhs) {
+    vec<n, T> ret = lhs;
     for (int i = n; i--; ret[i] /= rhs);
     return ret;
 }
 
-template<int n> std::ostream& operator<<(std::ostream& out, const vec<n>& v) {
+template<int n, typename T> std::ostream& operator<<(std::ostream& out, const vec<n, T>& v) {
     for (int i = 0; i < n; i++) out << v[i] << " ";
     return out;
 }
 
-template<> struct vec<2> {
-    double x = 0, y = 0;
-    double& operator[](const int i) { assert(i >= 0 && i < 2); return i ? y : x; }
-    double  operator[](const int i) const { assert(i >= 0 && i < 2); return i ? y : x; }
+template<typename T> struct vec<2, T> {
+    T x = 0, y = 0;
+    T& operator[](const int i) { assert(i >= 0 && i < 2); return (&x)[i]; }
+    T  operator[](const int i) const { assert(i >= 0 && i < 2); return (&x)[i]; }
+};
+
+template<typename T> struct vec<3, T> {
+    T x = 0, y = 0, z = 0;
+    T& operator[](const int i) { assert(i >= 0 && i < 3); return (&x)[i]; }
+    T  operator[](const int i) const { assert(i >= 0 && i < 3); return (&x)[i]; }
 };
 
-template<> struct vec<3> {
-    double x = 0, y = 0, z = 0;
-    double& operator[](const int i) { assert(i >= 0 && i < 3); return i ? (1 == i ? y : z) : x; }
-    double  operator[](const int i) const { assert(i >= 0 && i < 3); return i ? (1 == i ? y : z) : x; }
+template<typename T> struct vec<4, T> {
+    T x = 0, y = 0, z = 0, w = 0;
+    T& operator[](const int i) { assert(i >= 0 && i < 4); return (&x)[i]; }
+    T  operator[](const int i) const { assert(i >= 0 && i < 4); return (&x)[i]; }
+    vec<2, T> xy()  const { return { x, y }; }
+    vec<3, T> xyz() const { return { x, y, z }; }
 };
 
-template<> struct vec<4> {
-    double x = 0, y = 0, z = 0, w = 0;
-    double& operator[](const int i) { assert(i >= 0 && i < 4); return i < 2 ? (i ? y : x) : (2 == i ? z : w); }
-    double  operator[](const int i) const { assert(i >= 0 && i < 4); return i < 2 ? (i ? y : x) : (2 == i ? z : w); }
-    vec<2> xy()  const { return { x, y }; }
-    vec<3> xyz() const { return { x, y, z }; }
+template<> struct vec<4, float> { // aligned so that a whole vector is one SSE register
+    alignas(16) float x = 0;
+    float y = 0, z = 0, w = 0;
+    float& operator[](const int i) { assert(i >= 0 && i < 4); return (&x)[i]; }
+    float  operator[](const int i) const { assert(i >= 0 && i < 4); return (&x)[i]; }
+    vec<2, float> xy()  const { return { x, y }; }
+    vec<3, float> xyz() const { return { x, y, z }; }
 };
 
 typedef vec<2> vec2;
 typedef vec<3> vec3;
 typedef vec<4> vec4;
+typedef vec<2, float> vec2f;
+typedef vec<3, float> vec3f;
+typedef vec<4, float> vec4f;
 
-template<int n> double norm(const vec<n>& v) {
+template<int n, typename T> T norm(const vec<n, T>& v) {
     return std::sqrt(v * v);
 }
 
-template<int n> vec<n> normalized(const vec<n>& v) {
+template<int n, typename T> vec<n, T> normalized(const vec<n, T>& v) {
     return v / norm(v);
 }
 
-inline vec3 cross(const vec3& v1, const vec3& v2) {
+template<typename T> vec<3, T> cross(const vec<3, T>& v1, const vec<3, T>& v2) {
     return { v1.y * v2.z - v1.z * v2.y, v1.z * v2.x - v1.x * v2.z, v1.x * v2.y - v1.y * v2.x };
 }
 
-template<int n> struct dt;
+template<typename U, int n, typename T> vec<n, U> cast(const vec<n, T>& v) { // conversion between scalar types
+    vec<n, U> ret;
+    for (int i = n; i--; ret[i] = static_cast<U>(v[i]));
+    return ret;
+}
 
-template<int nrows, int ncols> struct mat {
-    vec<ncols> rows[nrows] = { {} };
+template<int n, typename T> struct dt;
 
-    vec<ncols>& operator[] (const int idx) { assert(idx >= 0 && idx < nrows); return rows[idx]; }
-    const vec<ncols>& operator[] (const int idx) const { assert(idx >= 0 && idx < nrows); return rows[idx]; }
+template<int nrows, int ncols, typename T = double> struct mat {
+    vec<ncols, T> rows[nrows] = { {} };
 
-    double det() const {
-        return dt<ncols>::det(*this);
+    vec<ncols, T>& operator[] (const int idx) { assert(idx >= 0 && idx < nrows); return rows[idx]; }
+    const vec<ncols, T>& operator[] (const int idx) const { assert(idx >= 0 && idx < nrows); return rows[idx]; }
+
+    T det() const {
+        return dt<ncols, T>::det(*this);
     }
 
-    double cofactor(const int row, const int col) const {
-        mat<nrows - 1, ncols - 1> submatrix;
+    T cofactor(const int row, const int col) const {
+        mat<nrows - 1, ncols - 1, T> submatrix;
         for (int i = nrows - 1; i--; )
             for (int j = ncols - 1; j--; submatrix[i][j] = rows[i + int(i >= row)][j + int(j >= col)]);
         return submatrix.det() * ((row + col) % 2 ? -1 : 1);
     }
 
-    mat<nrows, ncols> invert_transpose() const {
-        mat<nrows, ncols> adjugate_transpose; // transpose to ease determinant computation, check the last line
-        for (int i = nrows; i--; )
-            for (int j = ncols; j--; adjugate_transpose[i][j] = cofactor(i, j));
-        return adjugate_transpose / (adjugate_transpose[0] * rows[0]);
+    mat<nrows, ncols, T> invert_transpose() const {
+        return dt<ncols, T>::invert_transpose(*this);
     }
 
-    mat<nrows, ncols> invert() const {
+    mat<nrows, ncols, T> invert() const {
         return invert_transpose().transpose();
     }
 
-    mat<ncols, nrows> transpose() const {
-        mat<ncols, nrows> ret;
+    mat<ncols, nrows, T> transpose() const {
+        mat<ncols, nrows, T> ret;
         for (int i = ncols; i--; )
             for (int j = nrows; j--; ret[i][j] = rows[j][i]);
         return ret;
     }
 };
 
-template<int nrows, int ncols> vec<ncols> operator*(const vec<nrows>& lhs, const mat<nrows, ncols>& rhs) {
-    return (mat<1, nrows>{{lhs}}*rhs)[0];
+typedef mat<3, 3, float> mat3f;
+typedef mat<4, 4, float> mat4f;
+
+template<typename U, int nrows, int ncols, typename T> mat<nrows, ncols, U> cast(const mat<nrows, ncols, T>& m) {
+    mat<nrows, ncols, U> ret;
+    for (int i = nrows; i--; ret[i] = cast<U>(m[i]));
+    return ret;
 }
 
-template<int nrows, int ncols> vec<nrows> operator*(const mat<nrows, ncols>& lhs, const vec<ncols>& rhs) {
-    vec<nrows> ret;
+template<int nrows, int ncols, typename T> vec<ncols, T> operator*(const vec<nrows, T>& lhs, const mat<nrows, ncols, T>& rhs) {
+    return (mat<1, nrows, T>{{lhs}}*rhs)[0];
+}
+
+template<int nrows, int ncols, typename T> vec<nrows, T> operator*(const mat<nrows, ncols, T>& lhs, const vec<ncols, T>& rhs) {
+    vec<nrows, T> ret;
     for (int i = nrows; i--; ret[i] = lhs[i] * rhs);
     return ret;
 }
 
-template<int R1, int C1, int C2>mat<R1, C2> operator*(const mat<R1, C1>& lhs, const mat<C1, C2>& rhs) {
-    mat<R1, C2> result;
+#ifdef TR_SSE2
+inline vec4f operator*(const mat4f& lhs, const vec4f& rhs) { // the four row dot products at once
+    __m128 r0 = _mm_load_ps(&lhs[0].x), r1 = _mm_load_ps(&lhs[1].x), r2 = _mm_load_ps(&lhs[2].x), r3 = _mm_load_ps(&lhs[3].x);
+    const __m128 v = _mm_load_ps(&rhs.x);
+    r0 = _mm_mul_ps(r0, v);
+    r1 = _mm_mul_ps(r1, v);
+    r2 = _mm_mul_ps(r2, v);
+    r3 = _mm_mul_ps(r3, v);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    vec4f ret;
+    _mm_store_ps(&ret.x, _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)));
+    return ret;
+}
+#endif
+
+template<int R1, int C1, int C2, typename T> mat<R1, C2, T> operator*(const mat<R1, C1, T>& lhs, const mat<C1, C2, T>& rhs) {
+    mat<R1, C2, T> result;
     for (int i = R1; i--; )
         for (int j = C2; j--; )
             for (int k = C1; k--; result[i][j] += lhs[i][k] * rhs[k][j]);
     return result;
 }
 
-template<int nrows, int ncols>mat<nrows, ncols> operator*(const mat<nrows, ncols>& lhs, const double& val) {
-    mat<nrows, ncols> result;
+template<int nrows, int ncols, typename T> mat<nrows, ncols, T> operator*(const mat<nrows, ncols, T>& lhs, const scalar_t<T>& val) {
+    mat<nrows, ncols, T> result;
     for (int i = nrows; i--; result[i] = lhs[i] * val);
     return result;
 }
 
-template<int nrows, int ncols>mat<nrows, ncols> operator/(const mat<nrows, ncols>& lhs, const double& val) {
-    mat<nrows, ncols> result;
+template<int nrows, int ncols, typename T> mat<nrows, ncols, T> operator/(const mat<nrows, ncols, T>& lhs, const scalar_t<T>& val) {
+    mat<nrows, ncols, T> result;
     for (int i = nrows; i--; result[i] = lhs[i] / val);
     return result;
 }
 
-template<int nrows, int ncols>mat<nrows, ncols> operator+(const mat<nrows, ncols>& lhs, const mat<nrows, ncols>& rhs) {
-    mat<nrows, ncols> result;
+template<int nrows, int ncols, typename T> mat<nrows, ncols, T> operator+(const mat<nrows, ncols, T>& lhs, const mat<nrows, ncols, T>& rhs) {
+    mat<nrows, ncols, T> result;
     for (int i = nrows; i--; )
         for (int j = ncols; j--; result[i][j] = lhs[i][j] + rhs[i][j]);
     return result;
 }
 
-template<int nrows, int ncols>mat<nrows, ncols> operator-(const mat<nrows, ncols>& lhs, const mat<nrows, ncols>& rhs) {
-    mat<nrows, ncols> result;
+template<int nrows, int ncols, typename T> mat<nrows, ncols, T> operator-(const mat<nrows, ncols, T>& lhs, const mat<nrows, ncols, T>& rhs) {
+    mat<nrows, ncols, T> result;
     for (int i = nrows; i--; )
         for (int j = ncols; j--; result[i][j] = lhs[i][j] - rhs[i][j]);
     return result;
 }
 
-template<int nrows, int ncols> std::ostream& operator<<(std::ostream& out, const mat<nrows, ncols>& m) {
+template<int nrows, int ncols, typename T> std::ostream& operator<<(std::ostream& out, const mat<nrows, ncols, T>& m) {
     for (int i = 0; i < nrows; i++) out << m[i] << std::endl;
     return out;
 }
 
-template<int n> struct dt { // template metaprogramming to compute the determinant recursively
-    static double det(const mat<n, n>& src) {
-        double ret = 0;
+template<int n, typename T> struct dt { // template metaprogramming to compute the determinant recursively
+    static T det(const mat<n, n, T>& src) {
+        T ret = 0;
         for (int i = n; i--; ret += src[0][i] * src.cofactor(0, i));
         return ret;
     }
+
+    static mat<n, n, T> invert_transpose(const mat<n, n, T>& src) {
+        mat<n, n, T> adjugate_transpose; // transpose to ease determinant computation, check the last line
+        for (int i = n; i--; )
+            for (int j = n; j--; adjugate_transpose[i][j] = src.cofactor(i, j));
+        return adjugate_transpose / (adjugate_transpose[0] * src[0]);
+    }
 };
 
-template<> struct dt<1> {   // template specialization to stop the recursion
-    static double det(const mat<1, 1>& src) {
+template<typename T> struct dt<1, T> {   // template specialization to stop the recursion
+    static T det(const mat<1, 1, T>& src) {
         return src[0][0];
     }
 };
+
+template<typename T> struct dt<3, T> { // closed form, same operations in the same order as the cofactor expansion
+    static mat<3, 3, T> cofactors(const mat<3, 3, T>& m) {
+        return { { { m[1][1] * m[2][2] - m[1][2] * m[2][1], -(m[1][0] * m[2][2] - m[1][2] * m[2][0]), m[1][0] * m[2][1] - m[1][1] * m[2][0] },
+                   { -(m[0][1] * m[2][2] - m[0][2] * m[2][1]), m[0][0] * m[2][2] - m[0][2] * m[2][0], -(m[0][0] * m[2][1] - m[0][1] * m[2][0]) },
+                   { m[0][1] * m[1][2] - m[0][2] * m[1][1], -(m[0][0] * m[1][2] - m[0][2] * m[1][0]), m[0][0] * m[1][1] - m[0][1] * m[1][0] } } };
+    }
+
+    static T det(const mat<3, 3, T>& m) {
+        return m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]) + m[0][1] * -(m[1][0] * m[2][2] - m[1][2] * m[2][0]) + m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]);
+    }
+
+    static mat<3, 3, T> invert_transpose(const mat<3, 3, T>& m) {
+        const mat<3, 3, T> adjugate_transpose = cofactors(m);
+        return adjugate_transpose / (adjugate_transpose[0] * m[0]);
+    }
+};
+
+template<typename T> struct dt<4, T> { // closed form through the 2x2 minors of the two upper and the two lower rows
+    static T det(const mat<4, 4, T>& m) {
+        const T s0 = m[0][0] * m[1][1] - m[1][0] * m[0][1], s1 = m[0][0] * m[1][2] - m[1][0] * m[0][2], s2 = m[0][0] * m[1][3] - m[1][0] * m[0][3];
+        const T s3 = m[0][1] * m[1][2] - m[1][1] * m[0][2], s4 = m[0][1] * m[1][3] - m[1][1] * m[0][3], s5 = m[0][2] * m[1][3] - m[1][2] * m[0][3];
+        const T c5 = m[2][2] * m[3][3] - m[3][2] * m[2][3], c4 = m[2][1] * m[3][3] - m[3][1] * m[2][3], c3 = m[2][1] * m[3][2] - m[3][1] * m[2][2];
+        const T c2 = m[2][0] * m[3][3] - m[3][0] * m[2][3], c1 = m[2][0] * m[3][2] - m[3][0] * m[2][2], c0 = m[2][0] * m[3][1] - m[3][0] * m[2][1];
+        return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+    }
+
+    static mat<4, 4, T> invert_transpose(const mat<4, 4, T>& m) {
+        const T s0 = m[0][0] * m[1][1] - m[1][0] * m[0][1], s1 = m[0][0] * m[1][2] - m[1][0] * m[0][2], s2 = m[0][0] * m[1][3] - m[1][0] * m[0][3];
+        const T s3 = m[0][1] * m[1][2] - m[1][1] * m[0][2], s4 = m[0][1] * m[1][3] - m[1][1] * m[0][3], s5 = m[0][2] * m[1][3] - m[1][2] * m[0][3];
+        const T c5 = m[2][2] * m[3][3] - m[3][2] * m[2][3], c4 = m[2][1] * m[3][3] - m[3][1] * m[2][3], c3 = m[2][1] * m[3][2] - m[3][1] * m[2][2];
+        const T c2 = m[2][0] * m[3][3] - m[3][0] * m[2][3], c1 = m[2][0] * m[3][2] - m[3][0] * m[2][2], c0 = m[2][0] * m[3][1] - m[3][0] * m[2][1];
+        const T inv = 1 / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+        mat<4, 4, T> ret; // the inverse is the transposed adjugate over the determinant, this is its transpose
+        ret[0] = vec<4, T>{ m[1][1] * c5 - m[1][2] * c4 + m[1][3] * c3, -m[1][0] * c5 + m[1][2] * c2 - m[1][3] * c1,
+                            m[1][0] * c4 - m[1][1] * c2 + m[1][3] * c0, -m[1][0] * c3 + m[1][1] * c1 - m[1][2] * c0 } * inv;
+        ret[1] = vec<4, T>{ -m[0][1] * c5 + m[0][2] * c4 - m[0][3] * c3, m[0][0] * c5 - m[0][2] * c2 + m[0][3] * c1,
+                            -m[0][0] * c4 + m[0][1] * c2 - m[0][3] * c0, m[0][0] * c3 - m[0][1] * c1 + m[0][2] * c0 } * inv;
+        ret[2] = vec<4, T>{ m[3][1] * s5 - m[3][2] * s4 + m[3][3] * s3, -m[3][0] * s5 + m[3][2] * s2 - m[3][3] * s1,
+                            m[3][0] * s4 - m[3][1] * s2 + m[3][3] * s0, -m[3][0] * s3 + m[3][1] * s1 - m[3][2] * s0 } * inv;
+        ret[3] = vec<4, T>{ -m[2][1] * s5 + m[2][2] * s4 - m[2][3] * s3, m[2][0] * s5 - m[2][2] * s2 + m[2][3] * s1,
+                            -m[2][0] * s4 + m[2][1] * s2 - m[2][3] * s0, m[2][0] * s3 - m[2][1] * s1 + m[2][2] * s0 } * inv;
+        return ret;
+    }
+};
+
+template<int nrows, int ncols, typename T> void transform(const mat<nrows, ncols, T>& m, const vec<ncols, T>* in, vec<nrows, T>* out, const int n) {
+    for (int i = 0; i < n; i++) out[i] = m * in[i]; // batch transform of an array of vectors
+}
+
+// batch transform of the points {x,y,z,1} stored as a structure of arrays, the four output components as well
+inline void transform_points(const mat4f& m, const float* x, const float* y, const float* z, const int n, float* ox, float* oy, float* oz, float* ow) {
+    float* out[4] = { ox, oy, oz, ow };
+    int i = 0;
+#ifdef TR_SSE2
+    for (; i + 4 <= n; i += 4) {
+        const __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+        for (int r = 0; r < 4; r++) {
+            __m128 acc = _mm_mul_ps(_mm_set1_ps(m[r][0]), vx);
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(m[r][1]), vy));
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(m[r][2]), vz));
+            _mm_storeu_ps(out[r] + i, _mm_add_ps(acc, _mm_set1_ps(m[r][3])));
+        }
+    }
+#endif
+    for (; i < n; i++)
+        for (int r = 0; r < 4; r++) out[r][i] = m[r][0] * x[i] + m[r][1] * y[i] + m[r][2] * z[i] + m[r][3];
+}
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cmath>
+#include "instances.h"
+
+namespace {
+    Bounds world_bounds(const Bounds& b, const mat<4, 4>& transform) { // box of the 8 transformed corners, sphere scaled by the largest axis
+        const mat<4, 4> m = transform * ObjectFlip;
+        Bounds ret;
+        for (int corner = 0; corner < 8; corner++) {
+            const vec4 p = m * vec4{ corner & 1 ? b.max.x : b.min.x, corner & 2 ? b.max.y : b.min.y, corner & 4 ? b.max.z : b.min.z, 1 };
+            const vec3 q = p.xyz() / p.w;
+            for (int k = 0; k < 3; k++) {
+                ret.min[k] = corner ? std::min(ret.min[k], q[k]) : q[k];
+                ret.max[k] = corner ? std::max(ret.max[k], q[k]) : q[k];
+            }
+        }
+        const vec4 c = m * vec4{ b.center.x, b.center.y, b.center.z, 1 };
+        ret.center = c.xyz() / c.w;
+        double scale = 0;
+        for (int k = 0; k < 3; k++) scale = std::max(scale, norm(vec3{ m[0][k], m[1][k], m[2][k] }));
+        ret.radius = b.radius * scale;
+        return ret;
+    }
+
+    constexpr int kLeafInstances = 4;
+
+    void merge(Bounds& a, const Bounds& b, const bool first) { // box union, the sphere is finished by enclose()
+        for (int k = 0; k < 3; k++) {
+            a.min[k] = first ? b.min[k] : std::min(a.min[k], b.min[k]);
+            a.max[k] = first ? b.max[k] : std::max(a.max[k], b.max[k]);
+        }
+    }
+
+    template <typename Each> void enclose(Bounds& a, Each each) { // sphere around the box center holding the merged spheres
+        a.center = (a.min + a.max) / 2;
+        a.radius = 0;
+        each([&a](const Bounds& b) { a.radius = std::max(a.radius, norm(b.center - a.center) + b.radius); });
+        a.radius = std::min(a.radius, norm(a.max - a.min) / 2);
+    }
+}
+
+void InstanceBvh::clear() {
+    nodes.clear();
+    items.clear();
+    leaf_of.clear();
+}
+
+void InstanceBvh::build(const std::vector<Instance>& instances) {
+    clear();
+    const int n = static_cast<int>(instances.size());
+    if (!n) return;
+    items.resize(n);
+    leaf_of.resize(n);
+    for (int i = 0; i < n; i++) items[i] = i;
+    nodes.reserve(2 * ((n + kLeafInstances - 1) / kLeafInstances));
+    build(instances, 0, n, -1);
+}
+
+int InstanceBvh::build(const std::vector<Instance>& instances, const int first, const int count, const int parent) {
+    const int node = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+    nodes[node].parent = parent;
+    nodes[node].first = first;
+    nodes[node].count = count;
+    if (count <= kLeafInstances) {
+        for (int i = first; i < first + count; i++) leaf_of[items[i]] = node;
+        fit(instances, node);
+        return node;
+    }
+    vec3 lo = instances[items[first]].bounds.center, hi = lo;
+    for (int i = first + 1; i < first + count; i++)
+        for (int k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], instances[items[i]].bounds.center[k]);
+            hi[k] = std::max(hi[k], instances[items[i]].bounds.center[k]);
+        }
+    int axis = 0;
+    for (int k = 1; k < 3; k++) if (hi[k] - lo[k] > hi[axis] - lo[axis]) axis = k;
+    const int half = count / 2;
+    std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count, [&instances, axis](const int a, const int b) {
+        return instances[a].bounds.center[axis] < instances[b].bounds.center[axis];
+        });
+    const int left = build(instances, first, half, node);
+    const int right = build(instances, first + half, count - half, node);
+    nodes[node].left = left;
+    nodes[node].right = right;
+    fit(instances, node);
+    return node;
+}
+
+void InstanceBvh::fit(const std::vector<Instance>& instances, const int node) {
+    Node& n = nodes[node];
+    if (n.left < 0) {
+        for (int i = n.first; i < n.first + n.count; i++) merge(n.bounds, instances[items[i]].bounds, i == n.first);
+        enclose(n.bounds, [&](auto f) { for (int i = n.first; i < n.first + n.count; i++) f(instances[items[i]].bounds); });
+    }
+    else {
+        merge(n.bounds, nodes[n.left].bounds, true);
+        merge(n.bounds, nodes[n.right].bounds, false);
+        enclose(n.bounds, [&](auto f) { f(nodes[n.left].bounds); f(nodes[n.right].bounds); });
+    }
+}
+
+void InstanceBvh::refit(const std::vector<Instance>& instances, const int instance) {
+    for (int node = leaf_of[instance]; node >= 0; node = nodes[node].parent) {
+        const Bounds before = nodes[node].bounds;
+        fit(instances, node);
+        const Bounds& after = nodes[node].bounds;
+        bool same = after.radius == before.radius;
+        for (int k = 0; k < 3; k++) same = same && after.min[k] == before.min[k] && after.max[k] == before.max[k];
+        if (same) break; // the ancestors enclose the same bounds as before
+    }
+}
+
+void InstanceBvh::refit(const std::vector<Instance>& instances) {
+    for (int node = static_cast<int>(nodes.size()) - 1; node >= 0; node--) fit(instances, node);
+}
+
+void InstanceBvh::cull(const std::vector<Instance>& instances, const Frustum& frustum, std::vector<int>& visible) const {
+    if (nodes.empty()) return;
+    int stack[64]; // the median split keeps the depth logarithmic
+    int top = 0;
+    stack[top++] = 0;
+    while (top) {
+        const Node& n = nodes[stack[--top]];
+        if (frustum.culls(n.bounds)) continue;
+        const bool inside = frustum.contains(n.bounds);
+        if (n.left >= 0 && !inside) {
+            stack[top++] = n.right;
+            stack[top++] = n.left;
+            continue;
+        }
+        for (int i = n.first; i < n.first + n.count; i++) // a leaf, or a whole subtree on screen
+            if (inside || !frustum.culls(instances[items[i]].bounds)) visible.push_back(items[i]);
+    }
+}
+
+int InstanceScene::add_model(const Model& model) {
+    model_list.push_back(&model);
+    by_model.emplace_back();
+    return static_cast<int>(model_list.size()) - 1;
+}
+
+int InstanceScene::add(const int model, const mat<4, 4>& transform, const Material& material) {
+    Instance instance;
+    instance.model = model;
+    instance.material = material;
+    instance.transform = transform;
+    instance.bounds = world_bounds(model_list[model]->bounds(), transform);
+    instance_list.push_back(instance);
+    by_model[model].push_back(static_cast<int>(instance_list.size()) - 1);
+    bvh.clear();
+    return static_cast<int>(instance_list.size()) - 1;
+}
+
+void InstanceScene::set_transform(const int instance, const mat<4, 4>& transform) {
+    Instance& i = instance_list[instance];
+    i.transform = transform;
+    i.bounds = world_bounds(model_list[i.model]->bounds(), transform);
+    if (!bvh.empty()) bvh.refit(instance_list, instance);
+}
+
+void InstanceScene::update_bounds() {
+    for (Instance& i : instance_list) i.bounds = world_bounds(model_list[i.model]->bounds(), i.transform);
+    if (!bvh.empty()) bvh.refit(instance_list);
+}
+
+void InstanceScene::clear() {
+    model_list.clear();
+    instance_list.clear();
+    by_model.clear();
+    bvh.clear();
+}
+
+void InstanceScene::visible(const Frustum& frustum, std::vector<int>& out) const {
+    if (bvh.empty()) bvh.build(instance_list);
+    out.clear();
+    bvh.cull(instance_list, frustum, out);
+    std::sort(out.begin(), out.end()); // the draw order, and so the result of depth ties, does not depend on the tree
+}
+
+mat<4, 4> identity_transform() {
+    return { {{1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,0,1}} };
+}
+
+mat<4, 4> translation_scale(const vec3& translation, const double scale) {
+    return { {{scale,0,0,translation.x}, {0,scale,0,translation.y}, {0,0,scale,translation.z}, {0,0,0,1}} };
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "vertex_stage.h"
+
+// the shaders map object coordinates to {x,-y,z}: the draws and the world bounds of the instances both apply it through this
+inline const mat<4, 4> ObjectFlip = { {{1,0,0,0}, {0,-1,0,0}, {0,0,1,0}, {0,0,0,1}} };
+
+struct Material { // per-instance shading parameters, see IShader::set_instance()
+    vec3 color = { 1, 1, 1 }; // multiplies the color computed by the shader
+    double ambient = .3, diffuse = .4, specular = .9;
+};
+
+struct Instance { // one placement of a model shared with other instances
+    int model = 0;       // index in InstanceScene::models()
+    mat<4, 4> transform; // object to world, applied after the {x,-y,z} flip of the shaders and before ModelView
+    Material material;
+    Bounds bounds;       // of the model in world coordinates, see InstanceScene::update_bounds()
+};
+
+class InstanceBvh { // bounding volume hierarchy over the world bounds of the instances
+    struct Node {
+        Bounds bounds;
+        int parent = -1;
+        int left = -1, right = -1; // children, -1 for a leaf
+        int first = 0, count = 0;  // range of items, every subtree holds a contiguous one
+    };
+    std::vector<Node> nodes;  // depth first, a parent before its children
+    std::vector<int> items;   // instance indices grouped by leaf
+    std::vector<int> leaf_of; // per instance
+    int build(const std::vector<Instance>& instances, const int first, const int count, const int parent);
+    void fit(const std::vector<Instance>& instances, const int node);
+public:
+    void build(const std::vector<Instance>& instances); // top-down, median split along the longest axis of the centers
+    void refit(const std::vector<Instance>& instances, const int instance); // its leaf and the ancestors, until one does not change
+    void refit(const std::vector<Instance>& instances);                     // every node, bottom-up
+    void cull(const std::vector<Instance>& instances, const Frustum& frustum, std::vector<int>& visible) const; // appends the instances possibly on screen, unordered
+    void clear();
+    bool empty() const { return nodes.empty(); }
+};
+
+// Flat list of instances of a few models: the geometry, the meshlets and the textures of a model are loaded once whatever its
+// number of instances. The models are owned by the caller and must outlive the scene.
+class InstanceScene {
+    std::vector<const Model*> model_list;
+    std::vector<Instance> instance_list;
+    std::vector<std::vector<int>> by_model; // instances of each model, in insertion order
+    mutable InstanceBvh bvh;                // built on the first query after an add(), refitted by the updates
+public:
+    int add_model(const Model& model);      // index to pass to add()
+    int add(const int model, const mat<4, 4>& transform, const Material& material = {});
+    void set_transform(const int instance, const mat<4, 4>& transform);
+    void set_material(const int instance, const Material& material) { instance_list[instance].material = material; }
+    void update_bounds(); // of every instance, after the bounds of a model changed through Model::set_storage()
+    void clear();
+    void visible(const Frustum& frustum, std::vector<int>& out) const; // instances possibly on screen, in insertion order
+
+    const std::vector<const Model*>& models() const { return model_list; }
+    const std::vector<Instance>& instances() const { return instance_list; }
+    const std::vector<int>& instances_of(const int model) const { return by_model[model]; }
+};
+
+mat<4, 4> identity_transform();
+mat<4, 4> translation_scale(const vec3& translation, const double scale); // scale first
@@ -4,6 +4,11 @@
 #include "tinyrenderer.h"
 #include "model.h"
 #include "wyj_gl.h"
+#include "shaders.h"
+#include "profiler.h"
+#include "counters.h"
+#include "overlay.h"
+#include "frame_writer.h"
 
 // SDL
 #include <SDL.h>
@@ -15,6 +20,7 @@
 #include <thread>
 
 #include <iostream>
+#include <string>
 using namespace std;
 
 constexpr TGAColor white = TGAColor{255, 255, 255, 255};
@@ -32,6 +38,16 @@ TinyRenderer rendererfunc;
 static const int ScreenWidth = 800;
 static const int ScreenHeight = 800;
 
+#ifdef _WIN32 // font of the profiler overlay, --font <file.ttf> picks another one
+static std::string OverlayFont = "C:/Windows/Fonts/consola.ttf";
+#elif defined(__APPLE__)
+static std::string OverlayFont = "/System/Library/Fonts/Menlo.ttc";
+#else
+static std::string OverlayFont = "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf";
+#endif
+static const int OverlayFontSize = 14;
+static std::string HeatmapFile = "heatmap.tga"; // written by F3, --heatmap <file>; the extension picks TGA, QOI or PPM
+
 // 定义4x4的矩阵
 //mat<4, 4> ModelView, Viewport, Perspective;
 
@@ -42,62 +58,8 @@ extern std::vector<double> zbuffer;     // the depth buffer
 
 
 
-struct RandomShader : IShader {
-	const Model& model;
-	TGAColor color = {};
-	vec3 tri[3];  // triangle in eye coordinates
-
-	RandomShader(const Model& m) : model(m) {
-	}
-
-	virtual vec4 vertex(const int face, const int vert) {
-		vec4 v = model.vert(face, vert);                          // current vertex in object coordinates
-		vec4 gl_Position = ModelView * vec4{ v.x, -v.y, v.z, 1. };
-		tri[vert] = gl_Position.xyz();                            // in eye coordinates
-		return Perspective * gl_Position;                         // in clip coordinates
-	}
-
-	virtual std::pair<bool, TGAColor> fragment(const vec3 bar) const {
-		return { false, color };                                    // do not discard the pixel
-	}
-};
-
-struct PhongShader : IShader {
-	const Model& model;
-	vec3 l;          // light direction in eye coordinates
-	vec3 tri[3];     // triangle in eye coordinates
-	//vec3 varying_nrm[3]; // normal per vertex to be interpolated by the fragment
-
-	PhongShader(const vec3 light, const Model& m) : model(m) {
-		l = normalized((ModelView * vec4{ light.x, light.y, light.z, 0. }).xyz()); // transform the light vector to view coordinates
-	}
-
-	virtual vec4 vertex(const int face, const int vert) {
-		vec4 v = model.vert(face, vert);                          // current vertex in object coordinates
-		//vec4 n = model.normal(face, vert);
-		//varying_nrm[vert] = (ModelView.invert_transpose() * vec4 { n.x, n.y, n.z, 0. }).xyz();
-		vec4 gl_Position = ModelView * vec4{ v.x, -v.y, v.z, 1. };
-		tri[vert] = gl_Position.xyz();                            // in eye coordinates
-		return Perspective * gl_Position;                         // in clip coordinates
-	}
-
-	virtual std::pair<bool, TGAColor> fragment(const vec3 bar) const {
-		TGAColor gl_FragColor = { 255, 255, 255, 255 };             // output color of the fragment
-		vec3 n = normalized(cross(tri[2] - tri[0], tri[1] - tri[0]));// per-vertex normal 
-		//vec3 n = normalized(varying_nrm[0] * bar[0] + varying_nrm[1] * bar[1] + varying_nrm[2] * bar[2]);// per-vertex normal 
-		vec3 r = normalized(n * (n * l) * 2 - l);                   // reflected light direction
-		double ambient = .3;                                      // ambient light intensity
-		double diff = std::max(0., n * l);                        // diffuse light intensity
-		double spec = std::pow(std::max(r.z, 0.), 35);            // specular intensity, note that the camera lies on the z-axis (in eye coordinates), therefore simple r.z, since (0,0,1)*(r.x, r.y, r.z) = r.z
-		for (int channel : {0, 1, 2}){
-			gl_FragColor[channel] *= std::min(1., ambient + .4 * diff + .9 * spec);
-			//cout << ambient << " | " << diff << " | " << l << " | " << endl;
-		}
-		return { false, gl_FragColor };                             // do not discard the pixel
-	}
-};
-
 Model* model;
+InstanceScene scene; // instances of model, sharing its geometry
 RandomShader* randomshader;
 PhongShader* phongshader;
 
@@ -161,8 +123,11 @@ void Init()
 	init_perspective(norm(eye - center));                        // build the Perspective matrix
 	init_viewport(ScreenWidth / 16, ScreenHeight / 16, ScreenWidth * 7 / 8, ScreenHeight * 7 / 8); // build the Viewport    matrix
 	init_zbuffer(ScreenWidth, ScreenHeight);
+	set_id_buffer(true);                                         // left click picks the instance under the cursor
 	//TGAImage framebuffer(ScreenWidth, ScreenHeight, TGAImage::RGB, { 177, 195, 209, 255 });
 
+	scene.add(scene.add_model(*model), identity_transform());
+
 	randomshader = new RandomShader(*model);
 	phongshader = new PhongShader(light, *model);
 }
@@ -178,18 +143,39 @@ void Destory() {
 void ShowModel(SDL_Renderer* renderer)
 {
 	for (int i = ScreenWidth * ScreenHeight; i--; zbuffer[i] = -std::numeric_limits<float>::max());
+	clear_debug_buffers();
 
-	for (int f = 0; f < model->nfaces(); f++) {      // iterate through all facets
-		//randomshader->color = { (uint8_t)(std::rand() % 255), (uint8_t)(std::rand() % 255), (uint8_t)(std::rand() % 255), 255 };
-		Triangle clip = { phongshader->vertex(f, 0),  // assemble the primitive
-						  phongshader->vertex(f, 1),
-						  phongshader->vertex(f, 2) };
-		rasterize(clip, *phongshader, *renderer);   // rasterize the primitive
-	}
+	draw(*phongshader, scene, 0, *renderer); // instances of model: culling, batched vertex stage, then iterate through all facets
 }
 
 
 
+/// <summary>
+/// 用热力图覆盖画面（overdraw 或着色开销）
+/// </summary>
+/// <param name="renderer"></param>
+void ShowHeatmap(SDL_Renderer* renderer)
+{
+	TGAImage heatmap = debug_heatmap();
+	SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_BGR24, SDL_TEXTUREACCESS_STATIC, heatmap.width(), heatmap.height());
+	if (!texture) return;
+	SDL_UpdateTexture(texture, nullptr, heatmap.buffer(), heatmap.width() * heatmap.bytespp());
+	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+	SDL_DestroyTexture(texture);
+}
+
+/// <summary>
+/// 保存热力图并打印 overdraw 直方图
+/// </summary>
+void DumpHeatmap(FrameWriter& writer)
+{
+	writer.submit(HeatmapFile, debug_heatmap()); // encoded and written off the render thread
+	std::vector<int> histogram = overdraw_histogram();
+	cerr << "overdraw histogram (level: pixels)" << endl;
+	for (size_t i = 0; i < histogram.size(); i++)
+		cerr << (i + 1 == histogram.size() ? ">=" : "  ") << i << ": " << histogram[i] << endl;
+}
+
 /// <summary>
 /// 更新
 /// </summary>
@@ -227,6 +213,12 @@ int main(int argc, char** argv)
 	
 	using namespace std::chrono;
 
+	for (int i = 1; i + 1 < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--heatmap") HeatmapFile = argv[++i];
+		else if (arg == "--font") OverlayFont = argv[++i];
+	}
+
 	SDL_Init(SDL_INIT_EVERYTHING);
 	IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG);
 	Mix_Init(MIX_INIT_MP3);
@@ -246,6 +238,13 @@ int main(int argc, char** argv)
 
 	// 初始化设置
 	Init();
+
+	// 性能分析叠加层，F1 切换
+	TextOverlay overlay;
+	if (!overlay.init(renderer, OverlayFont.c_str(), OverlayFontSize))
+		cerr << "the F1 overlay needs a TrueType font, pass one with --font <file.ttf>" << endl;
+	bool show_overlay = false;
+	FrameWriter writer; // F3 heatmap dumps
 	//ResMgr::Instance()->Load(renderer);
 
 	//可交互区域
@@ -267,6 +266,23 @@ int main(int argc, char** argv)
 			case SDL_QUIT:
 				is_quit = true;
 				break;
+			case SDL_KEYDOWN:
+				if (event.key.keysym.sym == SDLK_F1) {
+					show_overlay = !show_overlay;
+					Profiler::instance().enabled = show_overlay; // no timing at all while hidden
+				}
+				else if (event.key.keysym.sym == SDLK_F2)     // cycle off -> overdraw -> shading cost
+					set_debug_view(static_cast<DebugView>((static_cast<int>(debug_view()) + 1) % 3));
+				else if (event.key.keysym.sym == SDLK_F3 && debug_view() != DebugView::Off)
+					DumpHeatmap(writer);
+				break;
+			case SDL_MOUSEBUTTONDOWN:
+				if (event.button.button == SDL_BUTTON_LEFT) {
+					const int picked = pick_instance(event.button.x, event.button.y);
+					if (picked < 0) std::cerr << "nothing picked" << std::endl;
+					else std::cerr << "picked instance " << picked << std::endl;
+				}
+				break;
 			}
 
 			/*CursorMgr::Instance()->OnInput(event);
@@ -282,7 +298,17 @@ int main(int argc, char** argv)
 		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); // 黑色背景
 		SDL_RenderClear(renderer);
 		OnRender(renderer);
-		SDL_RenderPresent(renderer);
+		if (debug_view() != DebugView::Off)
+			ShowHeatmap(renderer);
+		if (show_overlay)
+			draw_profiler_overlay(renderer, overlay, Profiler::instance(), &PipelineCounters::instance().last_frame());
+		{
+			PROFILE_SCOPE(Stage::Present);
+			SDL_RenderPresent(renderer);
+		}
+		if (show_overlay)
+			Profiler::instance().end_frame();
+		PipelineCounters::instance().end_frame();
 
 		last_tick = frame_start;
 
@@ -291,6 +317,10 @@ int main(int argc, char** argv)
 			std::this_thread::sleep_for(sleep_duration);
 	}
 
+	writer.flush();
+	if (writer.failed())
+		cerr << "can't write " << writer.failed() << " heatmap dump(s) to " << HeatmapFile << endl;
+	overlay.release();
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 
@@ -0,0 +1,82 @@
+#include <fstream>
+#include <iostream>
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::string filename) {
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER filesize;
+        if (GetFileSizeEx(file, &filesize) && filesize.QuadPart > 0) {
+            HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (map) {
+                mapping = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(map); // the view keeps the mapping alive
+            }
+            length = static_cast<std::size_t>(filesize.QuadPart);
+        }
+        CloseHandle(file);
+    }
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (!fstat(fd, &st) && st.st_size > 0) {
+            void* p = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) mapping = p;
+            length = static_cast<std::size_t>(st.st_size);
+        }
+        ::close(fd); // the mapping stays valid after the descriptor is closed
+    }
+#endif
+    if (mapping) {
+        ptr = static_cast<const std::uint8_t*>(mapping);
+        opened = true;
+        return true;
+    }
+
+    std::ifstream in(filename, std::ios::binary | std::ios::ate); // no mapping available: read the whole file
+    if (!in.is_open()) {
+        length = 0;
+        return false;
+    }
+    length = static_cast<std::size_t>(in.tellg());
+    fallback.resize(length);
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(fallback.data()), length);
+    if (!in.good() && length) {
+        std::cerr << "an error occured while reading " << filename << "\n";
+        close();
+        return false;
+    }
+    ptr = fallback.data();
+    opened = true;
+    return true;
+}
+
+void MappedFile::close() {
+    if (mapping) {
+#ifdef _WIN32
+        UnmapViewOfFile(mapping);
+#else
+        munmap(mapping, length);
+#endif
+    }
+    mapping = nullptr;
+    ptr = nullptr;
+    length = 0;
+    opened = false;
+    fallback = {};
+}
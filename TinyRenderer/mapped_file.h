@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class MappedFile { // read-only view of a whole file, memory-mapped when the OS allows it, read into memory otherwise
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string filename) { open(filename); }
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string filename);
+    void close();
+    const std::uint8_t* data() const { return ptr; }
+    const char* chars() const { return reinterpret_cast<const char*>(ptr); }
+    std::size_t size() const { return length; }
+    bool is_open() const { return opened; }
+    bool is_mapped() const { return mapping != nullptr; }
+private:
+    const std::uint8_t* ptr = nullptr;
+    std::size_t length = 0;
+    bool opened = false;             // an empty file is open but has no data
+    void* mapping = nullptr;         // base address of the mapping, nullptr when the file was read into fallback
+    std::vector<std::uint8_t> fallback = {};
+};
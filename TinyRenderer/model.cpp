@@ -1,11 +1,350 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <limits>
 #include <sstream>
+#include <thread>
+#include <type_traits>
 #include "model.h"
+#include "asset_cache.h"
+#include "mapped_file.h"
+#include "simplify.h"
 
-Model::Model(const std::string filename) {
+namespace {
+    constexpr std::size_t MinChunkSize = 1 << 20; // smaller files are parsed on the calling thread
+    constexpr int MaxLods = 6;                    // LOD levels including the original mesh
+    constexpr int MinLodFaces = 256;              // no level is simplified below that many triangles
+
+    struct ObjChunk { // arrays parsed from one range of lines, concatenated in file order afterwards
+        std::vector<vec4> verts, norms;
+        std::vector<vec2> tex;
+        std::vector<int> facet_vrt, facet_nrm, facet_tex;
+        double maxH = 0;
+        bool error = false; // a face that is not a triangle, parsing of the chunk stops there
+    };
+
+    // the helpers below mimic operator>> of std::istringstream on a single line
+    inline const char* skip_ws(const char* p, const char* end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f')) p++;
+        return p;
+    }
+
+    template <typename T> bool read_number(const char*& p, const char* end, T& value) {
+        p = skip_ws(p, end);
+        if (p < end && *p == '+' && p + 1 < end && *(p + 1) != '-') p++; // from_chars does not accept an explicit plus sign
+        std::from_chars_result r = std::from_chars(p, end, value);
+        if (r.ec != std::errc()) return false;
+        p = r.ptr;
+        return true;
+    }
+
+    inline bool read_char(const char*& p, const char* end) {
+        p = skip_ws(p, end);
+        if (p == end) return false;
+        p++;
+        return true;
+    }
+
+    inline bool starts_with(const char* p, const char* end, const char* prefix, const std::size_t len) {
+        return static_cast<std::size_t>(end - p) >= len && !std::memcmp(p, prefix, len);
+    }
+
+    void parse_lines(const char* p, const char* end, ObjChunk& out) {
+        while (p < end) {
+            const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (!eol) eol = end;
+            const char* c = p;
+            if (starts_with(p, eol, "v ", 2)) {
+                vec4 v = { 0,0,0,1 };
+                bool ok = true;
+                c++;
+                for (int i : {0, 1, 2}) {
+                    ok = ok && read_number(c, eol, v[i]);
+                    out.maxH = std::max(out.maxH, v[i]);
+                }
+                out.verts.push_back(v);
+            }
+            else if (starts_with(p, eol, "vn ", 3)) {
+                vec4 n;
+                c += 2;
+                for (int i : {0, 1, 2}) if (!read_number(c, eol, n[i])) break;
+                out.norms.push_back(normalized(n));
+            }
+            else if (starts_with(p, eol, "vt ", 3)) {
+                vec2 uv;
+                c += 2;
+                for (int i : {0, 1}) if (!read_number(c, eol, uv[i])) break;
+                out.tex.push_back({ uv.x, 1 - uv.y });
+            }
+            else if (starts_with(p, eol, "f ", 2)) {
+                int f, t, n, cnt = 0;
+                c++;
+                while (read_number(c, eol, f) && read_char(c, eol) && read_number(c, eol, t) && read_char(c, eol) && read_number(c, eol, n)) {
+                    out.facet_vrt.push_back(--f);
+                    out.facet_tex.push_back(--t);
+                    out.facet_nrm.push_back(--n);
+                    cnt++;
+                }
+                if (3 != cnt) {
+                    out.error = true;
+                    return;
+                }
+            }
+            p = eol + 1;
+        }
+    }
+
+    template <typename T> void append(std::vector<T>& dst, const std::vector<T>& src) {
+        dst.insert(dst.end(), src.begin(), src.end());
+    }
+
+    // mesh cache: a header followed by the six arrays of the model and the LOD table, each one aligned to CacheAlignment bytes,
+    // stored exactly as they are laid out in memory so that a mapped cache file can be used in place
+    constexpr char CacheMagic[8] = { 'T', 'R', 'M', 'E', 'S', 'H', 0, 0 };
+    constexpr std::uint32_t CacheVersion = 2; // 2: LOD levels
+    constexpr std::uint32_t CacheEndian = 0x01020304;
+    constexpr std::uint64_t CacheAlignment = 64;
+    enum CacheArray { CacheVerts, CacheNorms, CacheTex, CacheFacetVrt, CacheFacetNrm, CacheFacetTex, CacheLods, CacheArrays };
+
+    struct CacheHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t endian;          // CacheEndian as written by the producer
+        std::uint32_t sizes[4];        // sizeof(vec4), sizeof(vec2), sizeof(int), sizeof(LodLevel) of the producer
+        std::uint64_t source_size;     // ┐ identify the .obj file the cache was built from
+        std::uint64_t source_hash;     // ┘
+        double maxH;
+        std::uint64_t count[CacheArrays];
+        std::uint64_t offset[CacheArrays]; // in bytes from the beginning of the file
+    };
+
+    std::uint64_t aligned(const std::uint64_t offset) {
+        return (offset + CacheAlignment - 1) / CacheAlignment * CacheAlignment;
+    }
+
+    std::uint64_t content_hash(const std::uint8_t* data, const std::size_t size) { // FNV-1a over 64-bit words
+        std::uint64_t h = 0xcbf29ce484222325ull ^ size;
+        std::size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            std::uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            h = (h ^ word) * 0x100000001b3ull;
+            h ^= h >> 32;
+        }
+        for (; i < size; i++) h = (h ^ data[i]) * 0x100000001b3ull;
+        return h;
+    }
+
+    std::string cache_filename(const std::string& filename) {
+        size_t dot = filename.find_last_of(".");
+        return (dot == std::string::npos ? filename : filename.substr(0, dot)) + ".trmesh";
+    }
+}
+
+Model::Model(const std::string filename, const ObjLoader loader) {
+    bool ok = false;
+    if (loader == ObjLoader::Stream) ok = load_obj_stream(filename);
+    else if (loader == ObjLoader::Parallel) ok = load_obj(filename);
+    else {
+        MappedFile source;
+        if (!source.open(filename)) return;
+        const std::uint64_t hash = content_hash(source.data(), source.size());
+        const std::string cachefile = cache_filename(filename);
+        ok = load_cache(cachefile, source.size(), hash);
+        if (!ok && (ok = load_obj(filename))) {
+            build_lods();
+            write_cache(cachefile, source.size(), hash);
+        }
+    }
+    if (!ok) return;
+    if (!cache.is_open()) {
+        if (lod_levels.empty()) build_lods();
+        view_vectors();
+    }
+    build_meshlets();
+    std::cerr << "# v# " << nverts() << " f# " << nfaces() << std::endl;
+    std::cerr << "# lod";
+    for (const LodLevel& l : lod_levels) std::cerr << " f# " << l.nfaces << " (" << l.error << ")";
+    std::cerr << std::endl;
+    size_t dot = filename.find_last_of(".");
+    if (dot == std::string::npos) return;
+    texture_prefix = filename.substr(0, dot);
+    AssetCache& assets = AssetCache::instance();
+    auto log = [this](const std::string suffix, const bool ok) {
+        std::cerr << "texture file " << texture_prefix + suffix << " loading " << (ok ? "ok" : "failed") << std::endl;
+        };
+    log("_diffuse.tga", (diffusemap = assets.texture(texture_prefix + "_diffuse.tga")) != nullptr);
+    log("_nm_tangent.tga", (normalmap = assets.normal_map(texture_prefix + "_nm_tangent.tga")) != nullptr);
+    log("_nm.tga", (objectnormalmap = assets.normal_map(texture_prefix + "_nm.tga")) != nullptr);
+    log("_spec.tga", (specularmap = assets.texture(texture_prefix + "_spec.tga")) != nullptr);
+    const std::size_t normal_bytes = tangent_normals().bytes() + object_normals().bytes();
+    std::cerr << "# textures " << texture_bytes() / 1024 << " KB with the mip chains, of which normal maps " << normal_bytes / 1024
+        << " KB as float3, octahedral would take " << normal_bytes / 3 / 1024 << " KB" << std::endl;
+}
+
+void Model::view_vectors() {
+    verts_view = { verts.data(), verts.size() };
+    norms_view = { norms.data(), norms.size() };
+    tex_view = { tex.data(), tex.size() };
+    facet_vrt_view = { facet_vrt.data(), facet_vrt.size() };
+    facet_nrm_view = { facet_nrm.data(), facet_nrm.size() };
+    facet_tex_view = { facet_tex.data(), facet_tex.size() };
+}
+
+bool Model::load_obj(const std::string filename) {
+    auto start = std::chrono::steady_clock::now();
+    MappedFile file;
+    if (!file.open(filename)) return false;
+    const char* begin = file.chars();
+    const char* end = begin + file.size();
+
+    // split the file at line boundaries, every chunk is parsed by its own thread
+    std::size_t nchunks = std::max<std::size_t>(1, std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), file.size() / MinChunkSize));
+    std::vector<const char*> bounds = { begin };
+    for (std::size_t i = 1; i < nchunks; i++) {
+        const char* p = std::max(bounds.back(), begin + file.size() * i / nchunks);
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!eol) break;
+        bounds.push_back(eol + 1);
+    }
+    bounds.push_back(end);
+    nchunks = bounds.size() - 1;
+
+    std::vector<ObjChunk> chunks(nchunks);
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < nchunks; i++)
+        workers.emplace_back(parse_lines, bounds[i], bounds[i + 1], std::ref(chunks[i]));
+    parse_lines(bounds[0], bounds[1], chunks[0]);
+    for (std::thread& w : workers) w.join();
+
+    for (const ObjChunk& c : chunks) { // the indices in the .obj file are global, no rebasing is needed
+        append(verts, c.verts);
+        append(norms, c.norms);
+        append(tex, c.tex);
+        append(facet_vrt, c.facet_vrt);
+        append(facet_nrm, c.facet_nrm);
+        append(facet_tex, c.facet_tex);
+        maxH = std::max(maxH, c.maxH);
+        if (c.error) {
+            std::cerr << "Error: the obj file is supposed to be triangulated" << std::endl;
+            return false;
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    double mb = file.size() / (1024. * 1024.);
+    std::cerr << "# parsed " << mb << " MB in " << ms << " ms (" << (ms > 0 ? mb * 1000. / ms : 0.) << " MB/s, " << nchunks << " chunks)" << std::endl;
+    return true;
+}
+
+bool Model::load_cache(const std::string cachefile, const std::uint64_t source_size, const std::uint64_t source_hash) {
+    if (!cache.open(cachefile)) return false;
+    CacheHeader h;
+    bool ok = cache.size() >= sizeof(h);
+    if (ok) {
+        std::memcpy(&h, cache.data(), sizeof(h));
+        ok = !std::memcmp(h.magic, CacheMagic, sizeof(CacheMagic)) && h.version == CacheVersion && h.endian == CacheEndian &&
+            h.sizes[0] == sizeof(vec4) && h.sizes[1] == sizeof(vec2) && h.sizes[2] == sizeof(int) && h.sizes[3] == sizeof(LodLevel) &&
+            h.source_size == source_size && h.source_hash == source_hash;
+    }
+    auto section = [&](auto& view, const int i) { // bounds and alignment are checked before the view is set
+        using U = typename std::remove_const<typename std::remove_reference<decltype(view[0])>::type>::type;
+        ok = ok && h.offset[i] % alignof(U) == 0 && h.offset[i] <= cache.size() && h.count[i] <= (cache.size() - h.offset[i]) / sizeof(U);
+        if (ok) view = { reinterpret_cast<const U*>(cache.data() + h.offset[i]), static_cast<std::size_t>(h.count[i]) };
+        };
+    section(verts_view, CacheVerts);
+    section(norms_view, CacheNorms);
+    section(tex_view, CacheTex);
+    section(facet_vrt_view, CacheFacetVrt);
+    section(facet_nrm_view, CacheFacetNrm);
+    section(facet_tex_view, CacheFacetTex);
+    ArrayView<LodLevel> lods;
+    section(lods, CacheLods);
+    // the content is checked too, a corrupt file whose header matches must not lead vert() or build_meshlets() out of bounds
+    const std::size_t nindices = facet_vrt_view.size();
+    ok = ok && nindices % 3 == 0 && facet_nrm_view.size() == nindices && facet_tex_view.size() == nindices &&
+        nindices / 3 <= static_cast<std::size_t>(std::numeric_limits<int>::max()) && !lods.empty();
+    const int total = ok ? static_cast<int>(nindices / 3) : 0;
+    for (std::size_t l = 0; ok && l < lods.size(); l++) { // contiguous from face 0, the last level ending with the faces
+        const int first = l ? lods[l - 1].first_face + lods[l - 1].nfaces : 0;
+        ok = lods[l].first_face == first && lods[l].nfaces >= 0 && lods[l].nfaces <= total - first && (l + 1 < lods.size() || first + lods[l].nfaces == total);
+    }
+    auto below = [](const int i, const std::size_t n) { return i >= 0 && static_cast<std::size_t>(i) < n; };
+    for (std::size_t i = 0; ok && i < nindices; i++)
+        ok = below(facet_vrt_view[i], verts_view.size()) && below(facet_nrm_view[i], norms_view.size()) && below(facet_tex_view[i], tex_view.size());
+    if (!ok) {
+        std::cerr << "# mesh cache " << cachefile << " is stale or invalid, regenerating" << std::endl;
+        cache.close();
+        view_vectors();
+        return false;
+    }
+    maxH = h.maxH;
+    lod_levels.assign(lods.data(), lods.data() + lods.size()); // small, copied so that set_storage() can release the cache
+    std::cerr << "# mesh cache " << cachefile << (cache.is_mapped() ? " mapped" : " read") << std::endl;
+    return true;
+}
+
+bool Model::write_cache(const std::string cachefile, const std::uint64_t source_size, const std::uint64_t source_hash) const {
+    CacheHeader h = {};
+    std::memcpy(h.magic, CacheMagic, sizeof(CacheMagic));
+    h.version = CacheVersion;
+    h.endian = CacheEndian;
+    h.sizes[0] = sizeof(vec4);
+    h.sizes[1] = sizeof(vec2);
+    h.sizes[2] = sizeof(int);
+    h.sizes[3] = sizeof(LodLevel);
+    h.source_size = source_size;
+    h.source_hash = source_hash;
+    h.maxH = maxH;
+    const void* arrays[CacheArrays] = { verts.data(), norms.data(), tex.data(), facet_vrt.data(), facet_nrm.data(), facet_tex.data(), lod_levels.data() };
+    const std::uint64_t bytes[CacheArrays] = { verts.size() * sizeof(vec4), norms.size() * sizeof(vec4), tex.size() * sizeof(vec2),
+        facet_vrt.size() * sizeof(int), facet_nrm.size() * sizeof(int), facet_tex.size() * sizeof(int), lod_levels.size() * sizeof(LodLevel) };
+    const std::size_t counts[CacheArrays] = { verts.size(), norms.size(), tex.size(), facet_vrt.size(), facet_nrm.size(), facet_tex.size(), lod_levels.size() };
+    std::uint64_t offset = aligned(sizeof(h));
+    for (int i = 0; i < CacheArrays; i++) {
+        h.count[i] = counts[i];
+        h.offset[i] = offset;
+        offset = aligned(offset + bytes[i]);
+    }
+
+    const std::string tmpfile = cachefile + ".tmp"; // written aside then renamed, a concurrent reader never sees a partial file
+    std::ofstream out(tmpfile, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << tmpfile << "\n";
+        return false;
+    }
+    const char zeros[CacheAlignment] = {};
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    std::uint64_t pos = sizeof(h);
+    for (int i = 0; i < CacheArrays; i++) {
+        out.write(zeros, static_cast<std::streamsize>(h.offset[i] - pos));
+        out.write(static_cast<const char*>(arrays[i]), static_cast<std::streamsize>(bytes[i]));
+        pos = h.offset[i] + bytes[i];
+    }
+    out.close();
+    if (!out.good()) {
+        std::cerr << "can't write the mesh cache " << tmpfile << "\n";
+        std::remove(tmpfile.c_str());
+        return false;
+    }
+    std::remove(cachefile.c_str());
+    if (std::rename(tmpfile.c_str(), cachefile.c_str())) {
+        std::cerr << "can't rename " << tmpfile << " to " << cachefile << "\n";
+        std::remove(tmpfile.c_str());
+        return false;
+    }
+    std::cerr << "# mesh cache " << cachefile << " written" << std::endl;
+    return true;
+}
+
+bool Model::load_obj_stream(const std::string filename) {
     std::ifstream in;
     in.open(filename, std::ifstream::in);
-    if (in.fail()) return;
+    if (in.fail()) return false;
     std::string line;
     while (!in.eof()) {
         std::getline(in, line);
@@ -43,45 +382,363 @@ Model::Model(const std::string filename) {
             }
             if (3 != cnt) {
                 std::cerr << "Error: the obj file is supposed to be triangulated" << std::endl;
-                return;
+                return false;
             }
         }
     }
-    std::cerr << "# v# " << nverts() << " f# " << nfaces() << std::endl;
-    auto load_texture = [&filename](const std::string suffix, TGAImage& img) {
-        size_t dot = filename.find_last_of(".");
-        if (dot == std::string::npos) return;
-        std::string texfile = filename.substr(0, dot) + suffix;
-        std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-        };
-    load_texture("_diffuse.tga", diffusemap);
-    load_texture("_nm_tangent.tga", normalmap);
-    load_texture("_spec.tga", specularmap);
+    return true;
 }
 
-int Model::nverts() const { return verts.size(); }
-int Model::nfaces() const { return facet_vrt.size() / 3; }
+int Model::nverts() const {
+    if (storage_mode == VertexStorage::Float32) return verts32.n;
+    if (storage_mode == VertexStorage::Quantized) return packed.nverts;
+    return static_cast<int>(verts_view.size());
+}
+
+int Model::nfaces() const { return lod_levels.empty() ? total_faces() : lod_levels[0].nfaces; }
+
+int Model::total_faces() const { return (packed.facet_vrt.empty() ? static_cast<int>(facet_vrt_view.size()) : packed.nindices) / 3; }
 
 vec4 Model::vert(const int i) const {
-    return verts[i];
+    if (storage_mode == VertexStorage::Float32) return { verts32.x[i], verts32.y[i], verts32.z[i], 1 };
+    if (storage_mode == VertexStorage::Quantized) return packed.position(i);
+    return verts_view[i];
 }
 
 vec4 Model::vert(const int iface, const int nthvert) const {
-    return verts[facet_vrt[iface * 3 + nthvert]];
+    return vert(vert_index(iface, nthvert));
 }
 
 vec4 Model::normal(const int iface, const int nthvert) const {
-    return norms[facet_nrm[iface * 3 + nthvert]];
+    const int i = facet_index(facet_nrm_view, packed.facet_nrm, iface * 3 + nthvert);
+    if (storage_mode == VertexStorage::Float32) return { norms32.x[i], norms32.y[i], norms32.z[i], 0 };
+    if (storage_mode == VertexStorage::Quantized) return packed.normal(i);
+    return norms_view[i];
 }
 
 vec4 Model::normal(const vec2& uv) const {
-    TGAColor c = normalmap.get(uv[0] * normalmap.width(), uv[1] * normalmap.height());
-    return normalized(vec4{ (double)c[2],(double)c[1],(double)c[0],0 }*2. / 255. - vec4{ 1,1,1,0 });
+    const vec3 n = tangent_normals().sample(uv);
+    return { n.x, n.y, n.z, 0 };
+}
+
+vec4 Model::object_normal(const vec2& uv) const {
+    const vec3 n = object_normals().sample(uv);
+    return { n.x, n.y, n.z, 0 };
 }
 
 vec2 Model::uv(const int iface, const int nthvert) const {
-    return tex[facet_tex[iface * 3 + nthvert]];
+    const int i = facet_index(facet_tex_view, packed.facet_tex, iface * 3 + nthvert);
+    if (storage_mode == VertexStorage::Float32) return { tex32.u[i], tex32.v[i] };
+    if (storage_mode == VertexStorage::Quantized) return packed.uv(i);
+    return tex_view[i];
+}
+
+namespace {
+    const Texture no_texture;      // ┐ stand in for the missing files
+    const NormalMap no_normal_map; // ┘
+}
+
+const Texture& Model::diffuse()  const { return diffusemap ? *diffusemap : no_texture; }
+const Texture& Model::specular() const { return specularmap ? *specularmap : no_texture; }
+const NormalMap& Model::tangent_normals() const { return normalmap ? *normalmap : no_normal_map; }
+const NormalMap& Model::object_normals() const { return objectnormalmap ? *objectnormalmap : no_normal_map; }
+
+void Model::set_storage(const VertexStorage s) {
+    if (s == storage_mode) return;
+    // back to the double arrays first, every storage is then built from them
+    if (cache.is_open()) { // the arrays move out of the mapped cache before it is released
+        verts.assign(verts_view.data(), verts_view.data() + verts_view.size());
+        norms.assign(norms_view.data(), norms_view.data() + norms_view.size());
+        tex.assign(tex_view.data(), tex_view.data() + tex_view.size());
+        facet_vrt.assign(facet_vrt_view.data(), facet_vrt_view.data() + facet_vrt_view.size());
+        facet_nrm.assign(facet_nrm_view.data(), facet_nrm_view.data() + facet_nrm_view.size());
+        facet_tex.assign(facet_tex_view.data(), facet_tex_view.data() + facet_tex_view.size());
+        cache.close();
+    }
+    if (storage_mode != VertexStorage::Double) {
+        verts.resize(nverts());
+        for (int i = 0; i < nverts(); i++) verts[i] = vert(i);
+        if (storage_mode == VertexStorage::Float32) {
+            norms.resize(norms32.n);
+            for (int i = 0; i < norms32.n; i++) norms[i] = { norms32.x[i], norms32.y[i], norms32.z[i], 0 };
+            tex.resize(tex32.n);
+            for (int i = 0; i < tex32.n; i++) tex[i] = { tex32.u[i], tex32.v[i] };
+        }
+        else {
+            aligned_vector<float> x(packed.nnorms), y(packed.nnorms), z(packed.nnorms);
+            decode_normals(packed, 0, packed.nnorms, x.data(), y.data(), z.data()); // same values as packed.normal(i)
+            norms.resize(packed.nnorms);
+            for (int i = 0; i < packed.nnorms; i++) norms[i] = { x[i], y[i], z[i], 0 };
+            tex.resize(packed.ntex);
+            for (int i = 0; i < packed.ntex; i++) tex[i] = packed.uv(i);
+            if (!packed.facet_vrt.empty()) {
+                facet_vrt.assign(packed.facet_vrt.begin(), packed.facet_vrt.begin() + packed.nindices);
+                facet_nrm.assign(packed.facet_nrm.begin(), packed.facet_nrm.begin() + packed.nindices);
+                facet_tex.assign(packed.facet_tex.begin(), packed.facet_tex.begin() + packed.nindices);
+            }
+        }
+        verts32 = {};
+        norms32 = {};
+        tex32 = {};
+        packed = {};
+    }
+
+    if (s == VertexStorage::Float32) {
+        auto split3 = [](const std::vector<vec4>& src, Float3Arrays& dst) {
+            dst.n = static_cast<int>(src.size());
+            for (aligned_vector<float>* a : { &dst.x, &dst.y, &dst.z }) a->assign(simd_padded(src.size()), 0.f);
+            for (std::size_t i = 0; i < src.size(); i++) {
+                dst.x[i] = static_cast<float>(src[i].x);
+                dst.y[i] = static_cast<float>(src[i].y);
+                dst.z[i] = static_cast<float>(src[i].z);
+            }
+            };
+        split3(verts, verts32);
+        split3(norms, norms32);
+        tex32.n = static_cast<int>(tex.size());
+        tex32.u.assign(simd_padded(tex.size()), 0.f);
+        tex32.v.assign(simd_padded(tex.size()), 0.f);
+        for (std::size_t i = 0; i < tex.size(); i++) {
+            tex32.u[i] = static_cast<float>(tex[i].x);
+            tex32.v[i] = static_cast<float>(tex[i].y);
+        }
+    }
+    else if (s == VertexStorage::Quantized) {
+        packed = quantize_mesh(verts.data(), static_cast<int>(verts.size()), norms.data(), static_cast<int>(norms.size()),
+            tex.data(), static_cast<int>(tex.size()), facet_vrt.data(), facet_nrm.data(), facet_tex.data(), static_cast<int>(facet_vrt.size()));
+        if (!packed.facet_vrt.empty()) {
+            facet_vrt = {};
+            facet_nrm = {};
+            facet_tex = {};
+        }
+    }
+    if (s != VertexStorage::Double) {
+        verts = {};
+        norms = {};
+        tex = {};
+    }
+    storage_mode = s;
+    view_vectors();
+    compute_bounds(); // quantized positions move by up to half a step
+}
+
+namespace {
+    constexpr double kMeshletConeCos = 0.8; // a triangle joins a meshlet when within ~37 degrees of its average normal
+
+    template <typename Position> Bounds bounds_of(const int n, Position position) { // position(i) for 0 <= i < n
+        Bounds b;
+        if (!n) return b;
+        b.min = b.max = position(0);
+        for (int i = 1; i < n; i++) {
+            const vec3 p = position(i);
+            for (int k = 0; k < 3; k++) {
+                b.min[k] = std::min(b.min[k], p[k]);
+                b.max[k] = std::max(b.max[k], p[k]);
+            }
+        }
+        b.center = (b.min + b.max) / 2;
+        for (int i = 0; i < n; i++) b.radius = std::max(b.radius, norm(position(i) - b.center));
+        return b;
+    }
+}
+
+void Model::build_lods() {
+    const int n = static_cast<int>(facet_vrt.size()) / 3;
+    lod_levels = { LodLevel{ 0, n } };
+    const std::vector<SimplifiedLevel> levels = simplify_levels(verts.data(), static_cast<int>(verts.size()),
+        facet_vrt.data(), facet_nrm.data(), facet_tex.data(), n, MaxLods - 1, MinLodFaces);
+    for (const SimplifiedLevel& level : levels) {
+        LodLevel l;
+        l.first_face = static_cast<int>(facet_vrt.size()) / 3;
+        l.nfaces = static_cast<int>(level.facet_vrt.size()) / 3;
+        l.error = level.error;
+        append(facet_vrt, level.facet_vrt);
+        append(facet_nrm, level.facet_nrm);
+        append(facet_tex, level.facet_tex);
+        lod_levels.push_back(l);
+    }
+}
+
+void Model::build_meshlets() {
+    compute_bounds();
+    meshlet_list.clear();
+    meshlet_vrt.clear();
+    meshlet_idx.clear();
+    meshlet_face.clear();
+    for (LodLevel& l : lod_levels) {
+        l.first_meshlet = static_cast<int>(meshlet_list.size());
+        build_meshlets(l.first_face, l.nfaces);
+        l.nmeshlets = static_cast<int>(meshlet_list.size()) - l.first_meshlet;
+    }
+    compute_bounds();
+}
+
+void Model::build_meshlets(const int first_face, const int count) {
+    const int n = count, nv = nverts();
+    std::vector<std::uint32_t> code(n);
+    for (int i = 0; i < n; i++) { // 10 bits per axis of the centroid in the mesh box, interleaved
+        const vec3 c = (vert(first_face + i, 0).xyz() + vert(first_face + i, 1).xyz() + vert(first_face + i, 2).xyz()) / 3;
+        std::uint32_t m = 0;
+        for (int k = 0; k < 3; k++) {
+            const double extent = mesh_bounds.max[k] - mesh_bounds.min[k];
+            const std::uint32_t q = extent > 0 ? std::min(1023u, static_cast<std::uint32_t>((c[k] - mesh_bounds.min[k]) / extent * 1024)) : 0;
+            for (int bit = 0; bit < 10; bit++) m |= ((q >> bit) & 1u) << (bit * 3 + k);
+        }
+        code[i] = m;
+    }
+    auto corner = [this, first_face](const int f, const int k) { return vert_index(first_face + f, k); }; // f local to the level
+    std::vector<int> order(n), rank(n);
+    for (int f = 0; f < n; f++) order[f] = f;
+    std::stable_sort(order.begin(), order.end(), [&code](const int a, const int b) { return code[a] < code[b]; });
+    for (int i = 0; i < n; i++) rank[order[i]] = i;
+
+    std::vector<int> first_adj(nv + 1, 0), adj(n * 3); // triangles around each vertex
+    for (int f = 0; f < n; f++)
+        for (int k = 0; k < 3; k++) first_adj[corner(f, k) + 1]++;
+    for (int v = 0; v < nv; v++) first_adj[v + 1] += first_adj[v];
+    std::vector<int> fill(first_adj.begin(), first_adj.end() - 1);
+    for (int f = 0; f < n; f++)
+        for (int k = 0; k < 3; k++) adj[fill[corner(f, k)]++] = f;
+
+    std::vector<vec3> normal(n); // unit length, zero for degenerate triangles
+    for (int f = 0; f < n; f++) {
+        const vec3 a = vert(first_face + f, 0).xyz(), e = cross(vert(first_face + f, 1).xyz() - a, vert(first_face + f, 2).xyz() - a);
+        normal[f] = norm(e) > 0 ? e / norm(e) : vec3{ 0, 0, 0 };
+    }
+    std::vector<std::uint8_t> used(n, 0);
+    std::vector<int> local(nv, -1); // slot of a vertex in the current meshlet
+    vec3 normal_sum;
+    auto new_vertices = [&corner, &local](const int f) {
+        return (local[corner(f, 0)] < 0) + (local[corner(f, 1)] < 0) + (local[corner(f, 2)] < 0);
+        };
+    auto coherent = [&normal, &normal_sum](const int f) { // keeps the normal cone narrow enough for faces_away() to succeed
+        return normal[f] * normal_sum >= kMeshletConeCos * norm(normal_sum) || norm(normal[f]) == 0;
+        };
+    int next = 0;
+    while (true) {
+        while (next < n && used[order[next]]) next++;
+        if (next == n) break;
+        Meshlet m;
+        m.vertex_offset = static_cast<int>(meshlet_vrt.size());
+        m.triangle_offset = static_cast<int>(meshlet_face.size());
+        normal_sum = { 0, 0, 0 };
+        for (int f = order[next]; f >= 0 && m.triangle_count < kMeshletTriangles;) {
+            for (int k = 0; k < 3; k++) {
+                const int v = corner(f, k);
+                if (local[v] < 0) {
+                    local[v] = m.vertex_count++;
+                    meshlet_vrt.push_back(v);
+                }
+                meshlet_idx.push_back(static_cast<std::uint8_t>(local[v]));
+            }
+            meshlet_face.push_back(first_face + f);
+            normal_sum = normal_sum + normal[f];
+            used[f] = 1;
+            m.triangle_count++;
+
+            f = -1; // the first neighbor adding no vertex, or else the fewest with ties broken by the Morton order
+            int best = 4;
+            for (int i = m.vertex_offset; i < static_cast<int>(meshlet_vrt.size()) && best > 0; i++) {
+                const int v = meshlet_vrt[i];
+                for (int a = first_adj[v]; a < first_adj[v + 1]; a++) {
+                    const int g = adj[a];
+                    if (used[g]) continue;
+                    const int extra = new_vertices(g);
+                    if (m.vertex_count + extra > kMeshletVertices || !coherent(g)) continue;
+                    if (extra < best || (extra == best && rank[g] < rank[f])) {
+                        best = extra;
+                        f = g;
+                    }
+                }
+            }
+            if (f < 0) { // no neighbor left, continue with the next triangle in the Morton order
+                while (next < n && used[order[next]]) next++;
+                if (next < n && m.vertex_count + new_vertices(order[next]) <= kMeshletVertices && coherent(order[next])) f = order[next];
+            }
+        }
+        for (int i = m.vertex_offset; i < static_cast<int>(meshlet_vrt.size()); i++) local[meshlet_vrt[i]] = -1;
+        meshlet_list.push_back(m);
+    }
 }
 
-const TGAImage& Model::diffuse()  const { return diffusemap; }
-const TGAImage& Model::specular() const { return specularmap; }
+void Model::compute_bounds() {
+    mesh_bounds = bounds_of(nverts(), [this](const int i) { return vert(i).xyz(); });
+    for (Meshlet& m : meshlet_list) {
+        m.bounds = bounds_of(m.vertex_count, [this, &m](const int i) { return vert(meshlet_vrt[m.vertex_offset + i]).xyz(); });
+        vec3 normals[kMeshletTriangles];
+        vec3 sum = { 0, 0, 0 };
+        int count = 0;
+        for (int t = m.triangle_offset; t < m.triangle_offset + m.triangle_count; t++) {
+            const vec3 a = vert(meshlet_face[t], 0).xyz();
+            const vec3 n = cross(vert(meshlet_face[t], 1).xyz() - a, vert(meshlet_face[t], 2).xyz() - a);
+            const double len = norm(n);
+            if (len == 0) continue; // degenerate triangles are never drawn
+            normals[count] = n / len;
+            sum = sum + normals[count++];
+        }
+        m.cone_axis = sum;
+        m.cone_sin = 1;
+        if (norm(sum) < 1e-6) continue;
+        m.cone_axis = sum / norm(sum);
+        double cos_min = 1;
+        for (int i = 0; i < count; i++) cos_min = std::min(cos_min, normals[i] * m.cone_axis);
+        if (cos_min <= 0) continue;
+        m.cone_sin = std::sqrt(1 - cos_min * cos_min);
+        double t = 0; // the apex moves back along the axis until it lies behind all the planes
+        for (int i = 0, tri = m.triangle_offset; tri < m.triangle_offset + m.triangle_count; tri++) {
+            const vec3 a = vert(meshlet_face[tri], 0).xyz();
+            const vec3 n = cross(vert(meshlet_face[tri], 1).xyz() - a, vert(meshlet_face[tri], 2).xyz() - a);
+            if (norm(n) == 0) continue;
+            t = std::max(t, (m.bounds.center - a) * normals[i] / (m.cone_axis * normals[i]));
+            i++;
+        }
+        m.cone_apex = m.bounds.center - m.cone_axis * t;
+    }
+}
+
+Float3Stream Model::positions() const { return { verts32.x.data(), verts32.y.data(), verts32.z.data(), verts32.n }; }
+Float3Stream Model::normals() const { return { norms32.x.data(), norms32.y.data(), norms32.z.data(), norms32.n }; }
+Float2Stream Model::uvs() const { return { tex32.u.data(), tex32.v.data(), tex32.n }; }
+
+bool Model::same_geometry(const Model& other) const {
+    auto same = [](const auto& a, const auto& b) {
+        return a.size() == b.size() && (a.empty() || !std::memcmp(a.data(), b.data(), a.size() * sizeof(a[0])));
+        };
+    return storage_mode == other.storage_mode &&
+        same(verts_view, other.verts_view) && same(norms_view, other.norms_view) && same(tex_view, other.tex_view) &&
+        same(verts32.x, other.verts32.x) && same(verts32.y, other.verts32.y) && same(verts32.z, other.verts32.z) &&
+        same(norms32.x, other.norms32.x) && same(norms32.y, other.norms32.y) && same(norms32.z, other.norms32.z) &&
+        same(tex32.u, other.tex32.u) && same(tex32.v, other.tex32.v) &&
+        same(packed.px, other.packed.px) && same(packed.py, other.packed.py) && same(packed.pz, other.packed.pz) &&
+        same(packed.nx, other.packed.nx) && same(packed.ny, other.packed.ny) && same(packed.u, other.packed.u) && same(packed.v, other.packed.v) &&
+        same(packed.facet_vrt, other.packed.facet_vrt) && same(packed.facet_nrm, other.packed.facet_nrm) && same(packed.facet_tex, other.packed.facet_tex) &&
+        same(facet_vrt_view, other.facet_vrt_view) && same(facet_nrm_view, other.facet_nrm_view) && same(facet_tex_view, other.facet_tex_view) &&
+        maxH == other.maxH;
+}
+
+std::size_t Model::geometry_bytes() const {
+    std::size_t ret = verts_view.size() * sizeof(vec4) + norms_view.size() * sizeof(vec4) + tex_view.size() * sizeof(vec2) +
+        (facet_vrt_view.size() + facet_nrm_view.size() + facet_tex_view.size()) * sizeof(int);
+    for (const aligned_vector<float>* a : { &verts32.x, &verts32.y, &verts32.z, &norms32.x, &norms32.y, &norms32.z, &tex32.u, &tex32.v })
+        ret += a->capacity() * sizeof(float);
+    if (storage_mode == VertexStorage::Quantized) ret += packed.bytes();
+    ret += meshlet_list.size() * sizeof(Meshlet) + (meshlet_vrt.size() + meshlet_face.size()) * sizeof(int) + meshlet_idx.size();
+    ret += lod_levels.size() * sizeof(LodLevel);
+    return ret;
+}
+
+void Model::set_texture_layout(const TextureLayout layout) {
+    AssetCache& assets = AssetCache::instance();
+    if (diffusemap) diffusemap = assets.texture(texture_prefix + "_diffuse.tga", layout);
+    if (specularmap) specularmap = assets.texture(texture_prefix + "_spec.tga", layout);
+}
+
+void Model::set_normal_encoding(const NormalEncoding encoding) {
+    AssetCache& assets = AssetCache::instance();
+    if (normalmap) normalmap = assets.normal_map(texture_prefix + "_nm_tangent.tga", encoding);
+    if (objectnormalmap) objectnormalmap = assets.normal_map(texture_prefix + "_nm.tga", encoding);
+}
+
+std::size_t Model::texture_bytes() const {
+    return diffuse().bytes() + tangent_normals().bytes() + object_normals().bytes() + specular().bytes();
+}
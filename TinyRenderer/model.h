@@ -1,5 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include "geometry.h"
 #include "tgaimage.h"
+#include "texture.h"
+#include "normal_map.h"
+#include "mapped_file.h"
+#include "aligned.h"
+#include "quantized_mesh.h"
+
+template <typename T> struct ArrayView { // read-only array living in a std::vector or in a mapped file
+    const T* ptr = nullptr;
+    std::size_t count = 0;
+    const T& operator[](const std::size_t i) const { return ptr[i]; }
+    const T* data() const { return ptr; }
+    std::size_t size() const { return count; }
+    bool empty() const { return !count; }
+};
+
+enum class ObjLoader {
+    Cache,    // mesh cache next to the .obj file, (re)generated by the parallel parser when missing or stale
+    Parallel, // memory-mapped input parsed in parallel chunks
+    Stream    // reference std::getline/std::istringstream parser
+};
+
+enum class VertexStorage {
+    Double,  // vec4/vec2 arrays of doubles, as parsed or as mapped from the mesh cache
+    Float32, // separate float32 x/y/z and u/v arrays, SIMD aligned and zero-padded to simd_padded(n) elements
+    Quantized // 16-bit positions and uvs in their bounding boxes, octahedral normals, 16-bit indices when they fit
+};
+
+struct Float3Stream { // structure-of-arrays view of n float32 triples
+    const float* x = nullptr;
+    const float* y = nullptr;
+    const float* z = nullptr;
+    int n = 0;
+};
+
+struct Float2Stream {
+    const float* u = nullptr;
+    const float* v = nullptr;
+    int n = 0;
+};
+
+struct Bounds { // axis-aligned box and bounding sphere of a set of positions, in object coordinates
+    vec3 min, max;
+    vec3 center;     // center of the box, also the center of the sphere
+    double radius = 0;
+};
+
+constexpr int kMeshletVertices = 64, kMeshletTriangles = 124;
+
+struct Meshlet { // connected patch of triangles culled and transformed as a unit
+    int vertex_offset = 0, vertex_count = 0;     // range of Model::meshlet_vertices()
+    int triangle_offset = 0, triangle_count = 0; // range of Model::meshlet_faces(), 3 times that for Model::meshlet_indices()
+    Bounds bounds;
+    vec3 cone_axis;      // average direction of the triangle normals
+    double cone_sin = 1; // sine of the half angle of the normal cone, 1 when the normals cover a hemisphere or more
+    vec3 cone_apex;      // on the back side of every triangle plane, along the axis from the center of the bounds
+};
+
+struct LodLevel { // level of detail, level 0 is the mesh as loaded and the next ones are simplified by simplify_levels()
+    int first_face = 0, nfaces = 0;       // range of face indices, usable like the ones of level 0
+    int first_meshlet = 0, nmeshlets = 0; // range of Model::meshlets()
+    double error = 0;                     // bound on the distance to the original surface, in object units
+};
 
 class Model {
     std::vector<vec4> verts = {};    // array of vertices        ┐ generally speaking, these arrays
@@ -7,23 +74,88 @@ class Model {
     std::vector<vec2> tex = {};      // array of tex coords      ┘ check the logs of the Model() constructor
     std::vector<int> facet_vrt = {}; //  ┐ per-triangle indices in the above arrays,
     std::vector<int> facet_nrm = {}; //  │ the size is supposed to be
-    std::vector<int> facet_tex = {}; //  ┘ nfaces()*3
-    TGAImage diffusemap = {};       // diffuse color texture
-    TGAImage normalmap = {};       // normal map texture
-    TGAImage specularmap = {};       // specular texture
+    std::vector<int> facet_tex = {}; //  ┘ nfaces()*3, followed by the triangles of the other LOD levels
+    std::shared_ptr<const Texture> diffusemap = {};        // diffuse color texture   ┐ shared through AssetCache with
+    std::shared_ptr<const NormalMap> normalmap = {};       // tangent space normal map │ the other models loading the
+    std::shared_ptr<const NormalMap> objectnormalmap = {}; // object space normal map  │ same files, nullptr when the
+    std::shared_ptr<const Texture> specularmap = {};       // specular texture         ┘ file is missing
+    std::string texture_prefix = {}; // the .obj filename without its extension, the texture files add a suffix to it
 
-    double maxH;
+    // the accessors read the arrays through these views: they point either to the vectors above
+    // or directly into the mapped mesh cache, in which case the vectors stay empty
+    ArrayView<vec4> verts_view, norms_view;
+    ArrayView<vec2> tex_view;
+    ArrayView<int> facet_vrt_view, facet_nrm_view, facet_tex_view;
+    MappedFile cache = {};
+
+    struct Float3Arrays { aligned_vector<float> x, y, z; int n = 0; };
+    struct Float2Arrays { aligned_vector<float> u, v; int n = 0; };
+    VertexStorage storage_mode = VertexStorage::Double;
+    Float3Arrays verts32, norms32; // ┐ used instead of the double arrays in VertexStorage::Float32,
+    Float2Arrays tex32;            // ┘ the index arrays are shared by both storages
+    QuantizedMesh packed = {};     // VertexStorage::Quantized, its 16-bit indices replace the index arrays when present
+
+    double maxH = 0;
+    Bounds mesh_bounds = {};
+    std::vector<Meshlet> meshlet_list = {};
+    std::vector<int> meshlet_vrt = {};          // per meshlet, indices into the position array
+    std::vector<std::uint8_t> meshlet_idx = {}; // per meshlet triangle, its 3 corners in the meshlet vertices
+    std::vector<int> meshlet_face = {};         // per meshlet triangle, its index in the model
+    std::vector<LodLevel> lod_levels = {};
+
+    bool load_obj(const std::string filename);
+    bool load_obj_stream(const std::string filename);
+    bool load_cache(const std::string cachefile, const std::uint64_t source_size, const std::uint64_t source_hash); // false when missing, stale or malformed
+    bool write_cache(const std::string cachefile, const std::uint64_t source_size, const std::uint64_t source_hash) const;
+    void view_vectors();
+    void build_lods();     // appends the simplified levels to the index arrays, before they are cached
+    void build_meshlets(); // of every LOD level, see below
+    void build_meshlets(const int first_face, const int count); // greedy growth over shared vertices, seeded in the Morton order of the triangle centroids
+    void compute_bounds(); // of the mesh and of the meshlets, from the positions of the current storage
+    int facet_index(const ArrayView<int>& wide, const aligned_vector<std::uint16_t>& narrow, const int i) const {
+        return narrow.empty() ? wide[i] : narrow[i];
+    }
 public:
-    Model(const std::string filename);
+    Model(const std::string filename, const ObjLoader loader = ObjLoader::Cache);
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
     int nverts() const; // number of vertices
-    int nfaces() const; // number of triangles
+    int nfaces() const; // number of triangles of LOD level 0
+    int total_faces() const; // of all the LOD levels
     vec4 vert(const int i) const;                          // 0 <= i < nverts()
-    vec4 vert(const int iface, const int nthvert) const;   // 0 <= iface <= nfaces(), 0 <= nthvert < 3
+    vec4 vert(const int iface, const int nthvert) const;   // 0 <= iface < total_faces(), 0 <= nthvert < 3
+    int vert_index(const int iface, const int nthvert) const { return facet_index(facet_vrt_view, packed.facet_vrt, iface * 3 + nthvert); }
     vec4 normal(const int iface, const int nthvert) const; // normal coming from the "vn x y z" entries in the .obj file
-    vec4 normal(const vec2& uv) const;                     // normal vector from the normal map texture
+    vec4 normal(const vec2& uv) const;                     // unit normal vector from the tangent space normal map
+    vec4 object_normal(const vec2& uv) const;              // unit normal vector from the object space normal map
     vec2 uv(const int iface, const int nthvert) const;     // uv coordinates of triangle corners
-    const TGAImage& diffuse() const;
-    const TGAImage& specular() const;
+    const Texture& diffuse() const;
+    const Texture& specular() const;
+    const NormalMap& tangent_normals() const;
+    const NormalMap& object_normals() const;
+
+    void set_storage(const VertexStorage s);               // converts the vertex attributes, the previous arrays are released
+    void set_texture_layout(const TextureLayout layout);   // switches to the textures in that layout, see TextureLayout
+    void set_normal_encoding(const NormalEncoding encoding); // of both normal maps, float3 when loaded
+    VertexStorage storage() const { return storage_mode; }
+    Float3Stream positions() const;                        // ┐ batched access for the vertex stage,
+    Float3Stream normals() const;                          // │ empty unless storage() == VertexStorage::Float32
+    Float2Stream uvs() const;                              // ┘
+    const QuantizedMesh& quantized() const { return packed; } // empty unless storage() == VertexStorage::Quantized
+    const int* facet_vert_indices() const { return facet_vrt_view.data(); } // ┐ total_faces()*3 indices into the attribute arrays,
+    const int* facet_norm_indices() const { return facet_nrm_view.data(); } // │ nullptr when the quantized storage
+    const int* facet_uv_indices() const { return facet_tex_view.data(); }   // ┘ holds 16-bit indices instead
+    const Bounds& bounds() const { return mesh_bounds; }   // of all the vertices
+    const std::vector<Meshlet>& meshlets() const { return meshlet_list; }
+    const int* meshlet_vertices() const { return meshlet_vrt.data(); }         // ┐ see Meshlet, every triangle
+    const std::uint8_t* meshlet_indices() const { return meshlet_idx.data(); } // │ belongs to exactly one meshlet
+    const int* meshlet_faces() const { return meshlet_face.data(); }           // ┘
+    const std::vector<LodLevel>& lods() const { return lod_levels; }        // at least level 0 once loaded
+    int meshlet_vertex_count() const { return static_cast<int>(meshlet_vrt.size()); } // shared vertices are counted once per meshlet
+    std::size_t geometry_bytes() const;                    // memory held by the vertex attributes, the indices and the meshlets
+    std::size_t texture_bytes() const;                     // memory held by the textures and their mip chains
+
+    bool same_geometry(const Model& other) const;          // bitwise comparison of the arrays, both models in the same storage
 
     double GetMaxH() { return maxH; }
 };
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <cmath>
+#include "normal_map.h"
+#include "quantized_mesh.h"
+
+namespace {
+    double angle(const vec3& a, const vec3& b) { // in degrees, between unit vectors
+        return std::acos(std::min(1., std::max(-1., a * b))) * 180 / 3.14159265358979323846;
+    }
+}
+
+NormalMap::NormalMap(const TGAImage& img, const NormalEncoding encoding) : w(img.width()), h(img.height()) {
+    if (w <= 0 || h <= 0) {
+        w = h = 0;
+        return;
+    }
+    xyz.resize(static_cast<std::size_t>(w) * h * 3);
+#pragma omp parallel for
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            const TGAColor c = img.get(x, y);
+            vec3 n = vec3{ static_cast<double>(c[2]), static_cast<double>(c[1]), static_cast<double>(c[0]) } * 2. / 255. - vec3{ 1, 1, 1 };
+            n = norm(n) > 0 ? normalized(n) : vec3{ 0, 0, 1 };
+            float* p = &xyz[(x + static_cast<std::size_t>(y) * w) * 3];
+            p[0] = static_cast<float>(n.x);
+            p[1] = static_cast<float>(n.y);
+            p[2] = static_cast<float>(n.z);
+        }
+    set_encoding(encoding);
+}
+
+void NormalMap::set_encoding(const NormalEncoding encoding) {
+    if (encoding == format || empty()) {
+        format = encoding;
+        return;
+    }
+    const std::size_t n = static_cast<std::size_t>(w) * h;
+    if (encoding == NormalEncoding::Octahedral) {
+        oct.resize(n * 2);
+        std::vector<double> row_error(h, 0.);
+#pragma omp parallel for
+        for (int y = 0; y < h; y++)
+            for (std::size_t i = static_cast<std::size_t>(y) * w; i < static_cast<std::size_t>(y + 1) * w; i++) {
+                const vec3 v = { xyz[i * 3], xyz[i * 3 + 1], xyz[i * 3 + 2] };
+                octahedral_encode(v, oct[i * 2], oct[i * 2 + 1]);
+                row_error[y] = std::max(row_error[y], angle(normalized(v), octahedral_decode(oct[i * 2], oct[i * 2 + 1])));
+            }
+        error = *std::max_element(row_error.begin(), row_error.end());
+        xyz = std::vector<float>();
+    }
+    else { // the octahedral error stays, float32 adds nothing measurable
+        xyz.resize(n * 3);
+#pragma omp parallel for
+        for (int y = 0; y < h; y++)
+            for (std::size_t i = static_cast<std::size_t>(y) * w; i < static_cast<std::size_t>(y + 1) * w; i++) {
+                const vec3 v = octahedral_decode(oct[i * 2], oct[i * 2 + 1]);
+                for (int k = 0; k < 3; k++) xyz[i * 3 + k] = static_cast<float>(v[k]);
+            }
+        oct = std::vector<std::int16_t>();
+    }
+    format = encoding;
+}
+
+vec3 NormalMap::sample(const vec2& uv) const {
+    if (empty()) return { 0, 0, 1 };
+    int x = static_cast<int>(std::floor(uv.x * w)) % w, y = static_cast<int>(std::floor(uv.y * h)) % h;
+    if (x < 0) x += w;
+    if (y < 0) y += h;
+    const std::size_t i = x + static_cast<std::size_t>(y) * w;
+    if (format == NormalEncoding::Octahedral) return octahedral_decode(oct[i * 2], oct[i * 2 + 1]);
+    return { xyz[i * 3], xyz[i * 3 + 1], xyz[i * 3 + 2] };
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+
+enum class NormalEncoding {
+    Float3,    // 12 bytes per texel, read as is
+    Octahedral // 4 bytes per texel, snorm16 pair unfolded by octahedral_decode()
+};
+
+// Normal map decoded once from the bytes of a _nm.tga or _nm_tangent.tga texture, {r,g,b} * 2 / 255 - 1 normalized,
+// and sampled at the texel under uv with repeating coordinates, like the base level of a Texture.
+class NormalMap {
+    int w = 0, h = 0;
+    NormalEncoding format = NormalEncoding::Float3;
+    std::vector<float> xyz;         // Float3: unit vectors
+    std::vector<std::int16_t> oct;  // Octahedral: pairs
+    double error = 0;               // largest angle in degrees between a stored normal and the decoded bytes
+public:
+    NormalMap() = default;
+    NormalMap(const TGAImage& img, const NormalEncoding encoding);
+    bool empty() const { return !w; }
+    int width() const { return w; }
+    int height() const { return h; }
+    NormalEncoding encoding() const { return format; }
+    void set_encoding(const NormalEncoding encoding); // re-encodes the stored normals, from octahedral the decoded ones
+    vec3 sample(const vec2& uv) const;                // unit normal, {0,0,1} when empty, octahedral ones normalized here
+    std::size_t bytes() const { return xyz.size() * sizeof(float) + oct.size() * sizeof(std::int16_t); }
+    double max_error() const { return error; }
+};
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include "overlay.h"
+
+bool TextOverlay::init(SDL_Renderer* renderer, const char* fontfile, const int ptsize) {
+    release();
+    TTF_Font* font = TTF_OpenFont(fontfile, ptsize);
+    if (!font) {
+        std::cerr << "can't open font " << fontfile << ": " << TTF_GetError() << "\n";
+        return false;
+    }
+    height = TTF_FontLineSkip(font);
+
+    constexpr int atlas_width = 512;
+    constexpr SDL_Color white = { 255, 255, 255, 255 };
+    std::vector<SDL_Surface*> rendered(last - first + 1, nullptr);
+    int x = 0, y = 0, row_height = 0;
+    for (int c = first; c <= last; c++) { // pack the glyphs row by row
+        int i = c - first, minx, maxx, miny, maxy;
+        if (TTF_GlyphMetrics(font, static_cast<Uint16>(c), &minx, &maxx, &miny, &maxy, &advance[i])) advance[i] = 0;
+        rendered[i] = TTF_RenderGlyph_Blended(font, static_cast<Uint16>(c), white);
+        if (!rendered[i]) continue;
+        if (x + rendered[i]->w > atlas_width) {
+            x = 0;
+            y += row_height;
+            row_height = 0;
+        }
+        glyphs[i] = { x, y, rendered[i]->w, rendered[i]->h };
+        x += rendered[i]->w;
+        row_height = std::max(row_height, rendered[i]->h);
+    }
+    TTF_CloseFont(font);
+
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, atlas_width, std::max(1, y + row_height), 32, SDL_PIXELFORMAT_ARGB8888);
+    if (surface) {
+        SDL_FillRect(surface, nullptr, SDL_MapRGBA(surface->format, 0, 0, 0, 0));
+        for (int i = 0; i <= last - first; i++) {
+            if (!rendered[i]) continue;
+            SDL_SetSurfaceBlendMode(rendered[i], SDL_BLENDMODE_NONE); // copy the alpha channel as is
+            SDL_BlitSurface(rendered[i], nullptr, surface, &glyphs[i]);
+        }
+        atlas = SDL_CreateTextureFromSurface(renderer, surface);
+        SDL_FreeSurface(surface);
+    }
+    for (SDL_Surface* s : rendered) SDL_FreeSurface(s);
+    if (!atlas) {
+        std::cerr << "can't create the glyph atlas: " << SDL_GetError() << "\n";
+        return false;
+    }
+    SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+    return true;
+}
+
+void TextOverlay::release() {
+    if (atlas) SDL_DestroyTexture(atlas);
+    atlas = nullptr;
+}
+
+void TextOverlay::draw(SDL_Renderer* renderer, int x, const int y, const std::string& text, const SDL_Color color) const {
+    if (!atlas) return;
+    SDL_SetTextureColorMod(atlas, color.r, color.g, color.b);
+    SDL_SetTextureAlphaMod(atlas, color.a);
+    for (unsigned char c : text) {
+        if (c < first || c > last) c = '?';
+        const SDL_Rect& src = glyphs[c - first];
+        SDL_Rect dst = { x, y, src.w, src.h };
+        if (src.w) SDL_RenderCopy(renderer, atlas, &src, &dst);
+        x += advance[c - first];
+    }
+}
+
+int TextOverlay::text_width(const std::string& text) const {
+    int w = 0;
+    for (unsigned char c : text)
+        w += advance[(c < first || c > last ? '?' : c) - first];
+    return w;
+}
+
+void draw_profiler_overlay(SDL_Renderer* renderer, const TextOverlay& text, const Profiler& profiler, const FrameCounters* counters) {
+    if (!text.ready()) return;
+    std::vector<std::string> lines;
+    char buf[128];
+    lines.push_back("stage       min     avg     p99  (ms)");
+    double total = 0;
+    for (int s = 0; s < kStageCount; s++) {
+        StageStats st = profiler.stats(static_cast<Stage>(s));
+        std::snprintf(buf, sizeof(buf), "%-8s %7.2f %7.2f %7.2f", Profiler::name(static_cast<Stage>(s)), st.min, st.avg, st.p99);
+        lines.push_back(buf);
+        total += st.avg;
+    }
+    std::snprintf(buf, sizeof(buf), "total avg %6.2f ms", total);
+    lines.push_back(buf);
+    for (int t = 0; t < thread_count(); t++) {
+        StageStats st = profiler.thread_stats(t);
+        std::snprintf(buf, sizeof(buf), "thread %-2d %7.2f %7.2f %7.2f", t, st.min, st.avg, st.p99);
+        lines.push_back(buf);
+    }
+    if (counters) {
+        const FrameCounters& c = *counters;
+        std::snprintf(buf, sizeof(buf), "tris  sub %llu cull %llu small %llu rast %llu",
+            (unsigned long long)c[Counter::TrianglesSubmitted], (unsigned long long)c[Counter::TrianglesBackfaceCulled],
+            (unsigned long long)c[Counter::TrianglesTooSmall], (unsigned long long)c[Counter::TrianglesRasterized]);
+        lines.push_back(buf);
+        std::snprintf(buf, sizeof(buf), "frags tested %llu zfail %llu written %llu",
+            (unsigned long long)c[Counter::FragmentsTested], (unsigned long long)c[Counter::FragmentsDepthRejected],
+            (unsigned long long)c[Counter::FragmentsWritten]);
+        lines.push_back(buf);
+    }
+
+    int width = 0;
+    for (const std::string& l : lines) width = std::max(width, text.text_width(l));
+    SDL_Rect background = { 4, 4, width + 12, static_cast<int>(lines.size()) * text.line_height() + 8 };
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+    SDL_RenderFillRect(renderer, &background);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    for (size_t i = 0; i < lines.size(); i++)
+        text.draw(renderer, 10, 8 + static_cast<int>(i) * text.line_height(), lines[i], { 255, 255, 0, 255 });
+}
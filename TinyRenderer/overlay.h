@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+// SDL
+#include <SDL.h>
+#include <SDL_ttf.h>
+
+#include "profiler.h"
+#include "counters.h"
+
+class TextOverlay { // ASCII text drawn from a glyph atlas rasterized once with SDL_ttf
+public:
+    bool init(SDL_Renderer* renderer, const char* fontfile, const int ptsize);
+    void release();
+    void draw(SDL_Renderer* renderer, int x, const int y, const std::string& text, const SDL_Color color) const;
+    int text_width(const std::string& text) const;
+    int line_height() const { return height; }
+    bool ready() const { return atlas != nullptr; }
+private:
+    static constexpr int first = 32, last = 126; // printable ASCII range stored in the atlas
+    SDL_Texture* atlas = nullptr;
+    SDL_Rect glyphs[last - first + 1] = {};      // glyph rectangles in the atlas
+    int advance[last - first + 1] = {};
+    int height = 0;
+};
+
+void draw_profiler_overlay(SDL_Renderer* renderer, const TextOverlay& text, const Profiler& profiler, const FrameCounters* counters = nullptr);
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include "profiler.h"
+
+static std::atomic<int> nthreads{ 0 };
+
+int thread_slot() {
+    thread_local const int slot = nthreads.fetch_add(1, std::memory_order_relaxed) % kMaxThreads;
+    return slot;
+}
+
+int thread_count() {
+    return std::min(nthreads.load(std::memory_order_relaxed), kMaxThreads);
+}
+
+Profiler& Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler() : start_ticks(ticks()), start_time(std::chrono::steady_clock::now()) {}
+
+void Profiler::end_frame() {
+    std::uint64_t now_ticks = ticks();
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    double ms_per_tick = now_ticks > start_ticks ? elapsed_ms / (now_ticks - start_ticks) : 0.; // calibrated over the whole run
+
+    double stage_ms[kStageCount] = {};
+    for (int t = 0; t < kMaxThreads; t++) {
+        double thread_ms = 0;
+        for (int s = 0; s < kStageCount; s++) {
+            double ms = slots[t].ticks[s].exchange(0, std::memory_order_relaxed) * ms_per_tick;
+            stage_ms[s] += ms;
+            thread_ms += ms;
+        }
+        thread_history[t][cursor] = thread_ms;
+    }
+    for (int s = 0; s < kStageCount; s++)
+        history[s][cursor] = stage_ms[s];
+    cursor = (cursor + 1) % kHistory;
+    filled = std::min(filled + 1, kHistory);
+}
+
+StageStats Profiler::summarize(const std::array<double, kHistory>& samples, const int count) {
+    StageStats ret;
+    if (!count) return ret;
+    std::array<double, kHistory> sorted = samples;
+    std::sort(sorted.begin(), sorted.begin() + count);
+    ret.min = sorted[0];
+    for (int i = 0; i < count; i++) ret.avg += sorted[i];
+    ret.avg /= count;
+    ret.p99 = sorted[std::min(count - 1, static_cast<int>(count * .99))];
+    return ret;
+}
+
+StageStats Profiler::stats(const Stage s) const {
+    return summarize(history[static_cast<int>(s)], filled);
+}
+
+StageStats Profiler::thread_stats(const int slot) const {
+    return summarize(thread_history[slot], filled);
+}
+
+const char* Profiler::name(const Stage s) {
+    switch (s) {
+    case Stage::Vertex:  return "vertex";
+    case Stage::Setup:   return "setup";
+    case Stage::Raster:  return "raster";
+    case Stage::Shading: return "shading";
+    case Stage::Present: return "present";
+    default:             return "?";
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TR_HAS_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TR_HAS_RDTSC 1
+#endif
+
+enum class Stage { Vertex, Setup, Raster, Shading, Present, Count }; // pipeline stages measured by the profiler
+constexpr int kStageCount = static_cast<int>(Stage::Count);
+constexpr int kMaxThreads = 64;  // per-thread slots, threads beyond that share slots modulo kMaxThreads
+constexpr int kHistory = 240;    // number of frames kept for the rolling statistics
+
+int thread_slot();  // dense index of the calling thread, 0 <= thread_slot() < kMaxThreads
+int thread_count(); // number of threads that asked for a slot so far
+
+struct StageStats {
+    double min = 0, avg = 0, p99 = 0; // milliseconds per frame over the history window
+};
+
+class Profiler {
+public:
+    static Profiler& instance();
+
+    static std::uint64_t ticks() { // cheap timestamp, converted to time once per frame
+#ifdef TR_HAS_RDTSC
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    void add(const Stage s, const std::uint64_t dt) {
+        slots[thread_slot()].ticks[static_cast<int>(s)].fetch_add(dt, std::memory_order_relaxed);
+    }
+
+    void end_frame(); // folds the per-thread accumulators into the history, call once per frame from the main thread
+
+    StageStats stats(const Stage s) const;        // rolling statistics of a stage summed over all threads
+    StageStats thread_stats(const int slot) const; // rolling statistics of the time a thread spent in all stages
+    static const char* name(const Stage s);
+
+    bool enabled = false; // scopes cost a single branch when disabled
+private:
+    Profiler();
+    struct alignas(64) Slot { // one cache line per thread, so that the accumulators are never shared
+        std::atomic<std::uint64_t> ticks[kStageCount] = {};
+    };
+    static StageStats summarize(const std::array<double, kHistory>& samples, const int count);
+
+    Slot slots[kMaxThreads];
+    std::array<double, kHistory> history[kStageCount] = {};        // ms per frame and per stage
+    std::array<double, kHistory> thread_history[kMaxThreads] = {}; // ms per frame and per thread
+    int cursor = 0, filled = 0;
+    std::uint64_t start_ticks = 0;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+class ProfileScope { // RAII timer, accumulates the lifetime of the scope into the stage of the calling thread
+public:
+    explicit ProfileScope(const Stage s) : stage(s), start(Profiler::instance().enabled ? Profiler::ticks() : 0) {}
+    ~ProfileScope() { stop(); }
+    void stop() { // ends the measurement before the end of the scope
+        if (start) Profiler::instance().add(stage, Profiler::ticks() - start);
+        start = 0;
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+private:
+    const Stage stage;
+    std::uint64_t start;
+};
+
+#define TR_PROFILE_CONCAT_(a, b) a##b
+#define TR_PROFILE_CONCAT(a, b) TR_PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(stage) ProfileScope TR_PROFILE_CONCAT(profile_scope_, __LINE__)(stage)
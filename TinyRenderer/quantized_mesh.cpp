@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cmath>
+#include "quantized_mesh.h"
+
+namespace {
+    constexpr float kSnorm16 = 1.f / 32767.f;
+
+    std::uint16_t to_unorm16(const double v, const double min, const double range) {
+        return range > 0 ? static_cast<std::uint16_t>(std::lround(std::min(std::max((v - min) / range, 0.), 1.) * 65535.)) : 0;
+    }
+
+    std::int16_t to_snorm16(const double v) {
+        return static_cast<std::int16_t>(std::lround(std::min(std::max(v, -1.), 1.) * 32767.));
+    }
+
+    void octahedral_decode(float fx, float fy, float& x, float& y, float& z) { // same operations as the SSE2 path
+        z = 1.f - std::fabs(fx) - std::fabs(fy);
+        const float t = std::max(-z, 0.f);
+        fx += fx >= 0 ? -t : t;
+        fy += fy >= 0 ? -t : t;
+        const float inv = 1.f / std::sqrt(fx * fx + fy * fy + z * z);
+        x = fx * inv;
+        y = fy * inv;
+        z *= inv;
+    }
+
+    void decode_unorm16(const std::uint16_t* src, const int count, const float min, const float scale, float* dst) {
+        int i = 0;
+#ifdef TR_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128 vmin = _mm_set1_ps(min), vscale = _mm_set1_ps(scale);
+        for (; i + 8 <= count; i += 8) {
+            const __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            const __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(w, zero));
+            const __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(w, zero));
+            _mm_storeu_ps(dst + i, _mm_add_ps(vmin, _mm_mul_ps(lo, vscale)));
+            _mm_storeu_ps(dst + i + 4, _mm_add_ps(vmin, _mm_mul_ps(hi, vscale)));
+        }
+#endif
+        for (; i < count; i++) dst[i] = min + src[i] * scale;
+    }
+
+#ifdef TR_SSE2
+    void octahedral_decode4(const __m128i qx, const __m128i qy, float* x, float* y, float* z) { // four sign-extended snorm16 pairs
+        const __m128 sign = _mm_set1_ps(-0.f), one = _mm_set1_ps(1.f);
+        __m128 fx = _mm_mul_ps(_mm_cvtepi32_ps(qx), _mm_set1_ps(kSnorm16));
+        __m128 fy = _mm_mul_ps(_mm_cvtepi32_ps(qy), _mm_set1_ps(kSnorm16));
+        __m128 fz = _mm_sub_ps(_mm_sub_ps(one, _mm_andnot_ps(sign, fx)), _mm_andnot_ps(sign, fy));
+        const __m128 t = _mm_max_ps(_mm_xor_ps(fz, sign), _mm_setzero_ps());
+        fx = _mm_sub_ps(fx, _mm_or_ps(t, _mm_and_ps(fx, sign))); // fx -= copysign(t, fx)
+        fy = _mm_sub_ps(fy, _mm_or_ps(t, _mm_and_ps(fy, sign)));
+        const __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(fx, fx), _mm_mul_ps(fy, fy)), _mm_mul_ps(fz, fz)));
+        const __m128 inv = _mm_div_ps(one, len);
+        _mm_storeu_ps(x, _mm_mul_ps(fx, inv));
+        _mm_storeu_ps(y, _mm_mul_ps(fy, inv));
+        _mm_storeu_ps(z, _mm_mul_ps(fz, inv));
+    }
+#endif
+}
+
+void octahedral_encode(const vec3& n, std::int16_t& qx, std::int16_t& qy) { // project on |x|+|y|+|z| = 1, fold the lower hemisphere
+    const double l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    double ox = l1 > 0 ? n.x / l1 : 0, oy = l1 > 0 ? n.y / l1 : 0;
+    if (n.z < 0) {
+        const double fx = (1 - std::fabs(oy)) * (ox >= 0 ? 1 : -1);
+        oy = (1 - std::fabs(ox)) * (oy >= 0 ? 1 : -1);
+        ox = fx;
+    }
+    qx = to_snorm16(ox);
+    qy = to_snorm16(oy);
+}
+
+vec3 octahedral_decode(const std::int16_t qx, const std::int16_t qy) {
+    float x, y, z;
+    octahedral_decode(qx * kSnorm16, qy * kSnorm16, x, y, z);
+    return { x, y, z };
+}
+
+vec4 QuantizedMesh::normal(const int i) const {
+    const vec3 n = octahedral_decode(nx[i], ny[i]);
+    return { n.x, n.y, n.z, 0 };
+}
+
+std::size_t QuantizedMesh::bytes() const {
+    std::size_t ret = sizeof(*this);
+    for (const auto* a : { &px, &py, &pz, &u, &v, &facet_vrt, &facet_nrm, &facet_tex }) ret += a->capacity() * sizeof(std::uint16_t);
+    for (const auto* a : { &nx, &ny }) ret += a->capacity() * sizeof(std::int16_t);
+    return ret;
+}
+
+QuantizedMesh quantize_mesh(const vec4* verts, const int nverts, const vec4* norms, const int nnorms, const vec2* tex, const int ntex,
+    const int* facet_vrt, const int* facet_nrm, const int* facet_tex, const int nindices) {
+    QuantizedMesh q;
+    q.nverts = nverts;
+    q.nnorms = nnorms;
+    q.ntex = ntex;
+    q.nindices = nindices;
+
+    aligned_vector<std::uint16_t>* pos[3] = { &q.px, &q.py, &q.pz };
+    for (int axis : {0, 1, 2}) {
+        double lo = 0, hi = 0;
+        for (int i = 0; i < nverts; i++) {
+            lo = i ? std::min(lo, verts[i][axis]) : verts[i][axis];
+            hi = i ? std::max(hi, verts[i][axis]) : verts[i][axis];
+        }
+        q.pos_min[axis] = static_cast<float>(lo);
+        q.pos_scale[axis] = static_cast<float>((hi - lo) / 65535.);
+        pos[axis]->assign(simd_padded(nverts), 0);
+        for (int i = 0; i < nverts; i++) (*pos[axis])[i] = to_unorm16(verts[i][axis], lo, hi - lo);
+    }
+
+    q.nx.assign(simd_padded(nnorms), 0);
+    q.ny.assign(simd_padded(nnorms), 0);
+    for (int i = 0; i < nnorms; i++) octahedral_encode(norms[i].xyz(), q.nx[i], q.ny[i]);
+
+    aligned_vector<std::uint16_t>* uv[2] = { &q.u, &q.v };
+    for (int axis : {0, 1}) {
+        double lo = 0, hi = 0;
+        for (int i = 0; i < ntex; i++) {
+            lo = i ? std::min(lo, tex[i][axis]) : tex[i][axis];
+            hi = i ? std::max(hi, tex[i][axis]) : tex[i][axis];
+        }
+        q.uv_min[axis] = static_cast<float>(lo);
+        q.uv_scale[axis] = static_cast<float>((hi - lo) / 65535.);
+        uv[axis]->assign(simd_padded(ntex), 0);
+        for (int i = 0; i < ntex; i++) (*uv[axis])[i] = to_unorm16(tex[i][axis], lo, hi - lo);
+    }
+
+    if (std::max(nverts, std::max(nnorms, ntex)) <= 65536) { // otherwise the caller keeps its 32-bit indices
+        q.facet_vrt.assign(facet_vrt, facet_vrt + nindices);
+        q.facet_nrm.assign(facet_nrm, facet_nrm + nindices);
+        q.facet_tex.assign(facet_tex, facet_tex + nindices);
+    }
+    return q;
+}
+
+void decode_positions(const QuantizedMesh& q, const int first, const int count, float* x, float* y, float* z) {
+    decode_unorm16(q.px.data() + first, count, q.pos_min[0], q.pos_scale[0], x);
+    decode_unorm16(q.py.data() + first, count, q.pos_min[1], q.pos_scale[1], y);
+    decode_unorm16(q.pz.data() + first, count, q.pos_min[2], q.pos_scale[2], z);
+}
+
+void decode_positions(const QuantizedMesh& q, const int* indices, const int count, float* x, float* y, float* z) {
+    constexpr int kGather = 256; // 16-bit words staged on the stack, then converted like a contiguous range
+    std::uint16_t words[kGather];
+    const std::uint16_t* src[3] = { q.px.data(), q.py.data(), q.pz.data() };
+    for (int first = 0; first < count; first += kGather) {
+        const int n = std::min(kGather, count - first);
+        float* dst[3] = { x + first, y + first, z + first };
+        for (int axis = 0; axis < 3; axis++) {
+            for (int i = 0; i < n; i++) words[i] = src[axis][indices[first + i]];
+            decode_unorm16(words, n, q.pos_min[axis], q.pos_scale[axis], dst[axis]);
+        }
+    }
+}
+
+void decode_normals(const QuantizedMesh& q, const int first, const int count, float* x, float* y, float* z) {
+    const std::int16_t* nx = q.nx.data() + first;
+    const std::int16_t* ny = q.ny.data() + first;
+    int i = 0;
+#ifdef TR_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        const __m128i wx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(nx + i));
+        const __m128i wy = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ny + i));
+        octahedral_decode4(_mm_srai_epi32(_mm_unpacklo_epi16(zero, wx), 16), _mm_srai_epi32(_mm_unpacklo_epi16(zero, wy), 16), x + i, y + i, z + i);
+        octahedral_decode4(_mm_srai_epi32(_mm_unpackhi_epi16(zero, wx), 16), _mm_srai_epi32(_mm_unpackhi_epi16(zero, wy), 16), x + i + 4, y + i + 4, z + i + 4);
+    }
+#endif
+    for (; i < count; i++) octahedral_decode(nx[i] * kSnorm16, ny[i] * kSnorm16, x[i], y[i], z[i]);
+}
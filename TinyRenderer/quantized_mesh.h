@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "aligned.h"
+#include "geometry.h"
+
+struct QuantizedMesh { // compressed vertex attributes, see VertexStorage::Quantized
+    aligned_vector<std::uint16_t> px, py, pz;  // positions, unorm16 inside the bounding box
+    aligned_vector<std::int16_t> nx, ny;       // normals, snorm16 octahedral encoding
+    aligned_vector<std::uint16_t> u, v;        // tex coords, unorm16 inside the uv bounding box
+    aligned_vector<std::uint16_t> facet_vrt, facet_nrm, facet_tex; // empty when an attribute array has more than 65536 entries
+    float pos_min[3] = {}, pos_scale[3] = {};  // position = pos_min + q * pos_scale
+    float uv_min[2] = {}, uv_scale[2] = {};
+    int nverts = 0, nnorms = 0, ntex = 0, nindices = 0;
+
+    vec4 position(const int i) const {
+        return { pos_min[0] + px[i] * pos_scale[0], pos_min[1] + py[i] * pos_scale[1], pos_min[2] + pz[i] * pos_scale[2], 1 };
+    }
+    vec4 normal(const int i) const;
+    vec2 uv(const int i) const { return { uv_min[0] + u[i] * uv_scale[0], uv_min[1] + v[i] * uv_scale[1] }; }
+    std::size_t bytes() const;
+};
+
+QuantizedMesh quantize_mesh(const vec4* verts, const int nverts, const vec4* norms, const int nnorms, const vec2* tex, const int ntex,
+    const int* facet_vrt, const int* facet_nrm, const int* facet_tex, const int nindices);
+
+void octahedral_encode(const vec3& n, std::int16_t& qx, std::int16_t& qy); // snorm16 pair of a non-zero vector of any length
+vec3 octahedral_decode(const std::int16_t qx, const std::int16_t qy);       // unit vector
+
+// batch decoding into float32 arrays for the vertex stage, attributes [first, first+count)
+void decode_positions(const QuantizedMesh& q, const int first, const int count, float* x, float* y, float* z);
+void decode_normals(const QuantizedMesh& q, const int first, const int count, float* x, float* y, float* z);
+void decode_positions(const QuantizedMesh& q, const int* indices, const int count, float* x, float* y, float* z); // gathered, positions indices[0..count)
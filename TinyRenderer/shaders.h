@@ -0,0 +1,161 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include "model.h"
+#include "wyj_gl.h"
+
+struct RandomShader : IShader {
+	const Model& model;
+	TGAColor color = {};
+	vec3 tint = { 1, 1, 1 }; // material color of the current instance
+	vec3 tri[3];  // triangle in eye coordinates
+
+	RandomShader(const Model& m) : model(m) {
+	}
+
+	virtual vec4 vertex(const int face, const int vert) {
+		vec4 v = model.vert(face, vert);                          // current vertex in object coordinates
+		vec4 gl_Position = ModelView * vec4{ v.x, -v.y, v.z, 1. };
+		tri[vert] = gl_Position.xyz();                            // in eye coordinates
+		return Perspective * gl_Position;                         // in clip coordinates
+	}
+
+	virtual vec4 transformed_vertex(const int face, const int vert, const vec4& eye, const vec4& clip) {
+		tri[vert] = eye.xyz();
+		return clip;
+	}
+
+	virtual void set_instance(const Instance& instance) {
+		tint = instance.material.color;
+	}
+
+	virtual std::pair<bool, TGAColor> fragment(const vec3 bar) const {
+		TGAColor c = color;
+		for (int channel : {0, 1, 2}) c[channel] = static_cast<std::uint8_t>(c[channel] * std::min(1., tint[2 - channel])); // BGRA
+		return { false, c };                                        // do not discard the pixel
+	}
+};
+
+struct PhongShader : IShader {
+	const Model& model;
+	vec3 l;          // light direction in eye coordinates
+	vec3 tri[3];     // triangle in eye coordinates
+	Material material; // of the current instance
+	//vec3 varying_nrm[3]; // normal per vertex to be interpolated by the fragment
+
+	PhongShader(const vec3 light, const Model& m) : model(m) {
+		l = normalized((ModelView * vec4{ light.x, light.y, light.z, 0. }).xyz()); // transform the light vector to view coordinates
+	}
+
+	virtual vec4 vertex(const int face, const int vert) {
+		vec4 v = model.vert(face, vert);                          // current vertex in object coordinates
+		//vec4 n = model.normal(face, vert);
+		//varying_nrm[vert] = (ModelView.invert_transpose() * vec4 { n.x, n.y, n.z, 0. }).xyz();
+		vec4 gl_Position = ModelView * vec4{ v.x, -v.y, v.z, 1. };
+		tri[vert] = gl_Position.xyz();                            // in eye coordinates
+		return Perspective * gl_Position;                         // in clip coordinates
+	}
+
+	virtual vec4 transformed_vertex(const int face, const int vert, const vec4& eye, const vec4& clip) {
+		tri[vert] = eye.xyz();
+		return clip;
+	}
+
+	virtual void set_instance(const Instance& instance) {
+		material = instance.material;
+	}
+
+	virtual std::pair<bool, TGAColor> fragment(const vec3 bar) const {
+		TGAColor gl_FragColor = { 255, 255, 255, 255 };             // output color of the fragment
+		vec3 n = normalized(cross(tri[2] - tri[0], tri[1] - tri[0]));// per-vertex normal 
+		//vec3 n = normalized(varying_nrm[0] * bar[0] + varying_nrm[1] * bar[1] + varying_nrm[2] * bar[2]);// per-vertex normal 
+		vec3 r = normalized(n * (n * l) * 2 - l);                   // reflected light direction
+		double ambient = material.ambient;                        // ambient light intensity
+		double diff = std::max(0., n * l);                        // diffuse light intensity
+		double spec = std::pow(std::max(r.z, 0.), 35);            // specular intensity, note that the camera lies on the z-axis (in eye coordinates), therefore simple r.z, since (0,0,1)*(r.x, r.y, r.z) = r.z
+		for (int channel : {0, 1, 2}){
+			gl_FragColor[channel] *= std::min(1., ambient + material.diffuse * diff + material.specular * spec) * std::min(1., material.color[2 - channel]); // BGRA
+			//cout << ambient << " | " << diff << " | " << l << " | " << endl;
+		}
+		return { false, gl_FragColor };                             // do not discard the pixel
+	}
+};
+
+// Phong lighting of the diffuse texture, both textures sampled trilinearly. TexturedShader<TextureProbe> instruments the
+// texel fetches, the diffuse ones with diffuse_probe; the default one leaves them unchecked.
+template <typename Probe = NoProbe> struct TexturedShader : IShader {
+	const Model& model;
+	vec3 l;          // light direction in eye coordinates
+	vec3 tri[3];     // triangle in eye coordinates
+	vec2 varying_uv[3];
+	Material material; // of the current instance
+	Sampler<Wrap::Repeat, Wrap::Repeat, Probe> diffuse, specular;
+
+	TexturedShader(const vec3 light, const Model& m, const Probe diffuse_probe = {}) : model(m), diffuse(m.diffuse(), diffuse_probe), specular(m.specular()) {
+		l = normalized((ModelView * vec4{ light.x, light.y, light.z, 0. }).xyz()); // transform the light vector to view coordinates
+	}
+
+	virtual vec4 vertex(const int face, const int vert) {
+		vec4 v = model.vert(face, vert);                          // current vertex in object coordinates
+		vec4 gl_Position = ModelView * vec4{ v.x, -v.y, v.z, 1. };
+		tri[vert] = gl_Position.xyz();                            // in eye coordinates
+		varying_uv[vert] = model.uv(face, vert);
+		return Perspective * gl_Position;                         // in clip coordinates
+	}
+
+	virtual vec4 transformed_vertex(const int face, const int vert, const vec4& eye, const vec4& clip) {
+		tri[vert] = eye.xyz();
+		varying_uv[vert] = model.uv(face, vert);
+		return clip;
+	}
+
+	virtual void set_instance(const Instance& instance) {
+		material = instance.material;
+	}
+
+	virtual std::pair<bool, TGAColor> fragment(const vec3 bar) const {
+		return fragment_with_derivatives(bar, { 0, 0, 0 }, { 0, 0, 0 }); // base level
+	}
+
+	virtual std::pair<bool, TGAColor> fragment_with_derivatives(const vec3 bar, const vec3& dbar_dx, const vec3& dbar_dy) const {
+		auto interpolate = [this](const vec3& b) { return varying_uv[2] * b[0] + varying_uv[1] * b[1] + varying_uv[0] * b[2]; }; // rasterize() visits the corners in reverse order
+		const vec2 uv = interpolate(bar), duv_dx = interpolate(dbar_dx), duv_dy = interpolate(dbar_dy);
+		const Texture& d = diffuse.texture(), & s = specular.texture();
+		TGAColor gl_FragColor = d.empty() ? TGAColor{ 255, 255, 255, 255 } : diffuse.trilinear(uv, d.lod(duv_dx, duv_dy));
+		const double gloss = s.empty() ? 1. : specular.trilinear(uv, s.lod(duv_dx, duv_dy))[0] / 255.;
+		vec3 n = normalized(cross(tri[2] - tri[0], tri[1] - tri[0]));// per-face normal
+		vec3 r = normalized(n * (n * l) * 2 - l);                   // reflected light direction
+		double diff = std::max(0., n * l);                        // diffuse light intensity
+		double spec = std::pow(std::max(r.z, 0.), 35);            // specular intensity, the camera lies on the z-axis in eye coordinates
+		for (int channel : {0, 1, 2})
+			gl_FragColor[channel] = static_cast<std::uint8_t>(std::min(255., gl_FragColor[channel] * (material.ambient + material.diffuse * diff) * std::min(1., material.color[2 - channel]) +
+				255. * material.specular * gloss * spec)); // BGRA
+		return { false, gl_FragColor };                             // do not discard the pixel
+	}
+};
+
+struct DepthShader : IShader { // depth-only pass, the color is the interpolated depth
+	const Model& model;
+	double depth[3];  // normalized device depth of the triangle corners
+
+	DepthShader(const Model& m) : model(m) {
+	}
+
+	virtual vec4 vertex(const int face, const int vert) {
+		vec4 v = model.vert(face, vert);                          // current vertex in object coordinates
+		vec4 gl_Position = Perspective * (ModelView * vec4{ v.x, -v.y, v.z, 1. });
+		depth[vert] = gl_Position.z / gl_Position.w;
+		return gl_Position;                                       // in clip coordinates
+	}
+
+	virtual vec4 transformed_vertex(const int face, const int vert, const vec4& eye, const vec4& clip) {
+		depth[vert] = clip.z / clip.w;
+		return clip;
+	}
+
+	virtual std::pair<bool, TGAColor> fragment(const vec3 bar) const {
+		double z = bar[0] * depth[2] + bar[1] * depth[1] + bar[2] * depth[0]; // rasterize() visits the corners in reverse order
+		std::uint8_t c = static_cast<std::uint8_t>(std::max(0., std::min((z + 1.) * 127.5, 255.)));
+		return { false, { c, c, c, 255 } };                          // do not discard the pixel
+	}
+};
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include "simplify.h"
+
+namespace {
+    struct Quadric { // sum of the squared distances to a set of planes, symmetric 4x4 matrix stored as its upper triangle
+        double xx = 0, xy = 0, xz = 0, xd = 0, yy = 0, yz = 0, yd = 0, zz = 0, zd = 0, dd = 0;
+
+        void add_plane(const vec3& n, const double d) { // n * p + d = 0 with |n| = 1
+            xx += n.x * n.x; xy += n.x * n.y; xz += n.x * n.z; xd += n.x * d;
+            yy += n.y * n.y; yz += n.y * n.z; yd += n.y * d;
+            zz += n.z * n.z; zd += n.z * d;
+            dd += d * d;
+        }
+        Quadric operator+(const Quadric& q) const {
+            Quadric r = *this;
+            r.xx += q.xx; r.xy += q.xy; r.xz += q.xz; r.xd += q.xd; r.yy += q.yy;
+            r.yz += q.yz; r.yd += q.yd; r.zz += q.zz; r.zd += q.zd; r.dd += q.dd;
+            return r;
+        }
+        double error(const vec3& p) const {
+            return xx * p.x * p.x + 2 * xy * p.x * p.y + 2 * xz * p.x * p.z + 2 * xd * p.x +
+                yy * p.y * p.y + 2 * yz * p.y * p.z + 2 * yd * p.y + zz * p.z * p.z + 2 * zd * p.z + dd;
+        }
+    };
+
+    struct Collapse { // moves the vertex u onto its neighbor v
+        double cost;
+        int u, v;
+        unsigned version_u, version_v; // the candidate is stale once either vertex has changed
+        bool operator<(const Collapse& other) const { return cost > other.cost; } // cheapest first in std::priority_queue
+    };
+
+    class Simplifier {
+        std::vector<vec3> pos;
+        std::vector<int> vrt, nrm, tex;           // 3 corners per triangle, updated in place
+        std::vector<std::uint8_t> alive;          // per triangle
+        std::vector<std::vector<int>> ring;       // triangles around each vertex, dead ones are skipped
+        std::vector<std::uint8_t> locked;
+        std::vector<unsigned> version;
+        std::vector<Quadric> quadric;
+        std::priority_queue<Collapse> heap;
+        double max_cost = 0;
+
+        int corner(const int t, const int v) const { // -1 when v is not a corner of t
+            for (int k = 0; k < 3; k++) if (vrt[t * 3 + k] == v) return k;
+            return -1;
+        }
+        void push(const int u, const int v) {
+            if (locked[u]) return;
+            heap.push({ (quadric[u] + quadric[v]).error(pos[v]), u, v, version[u], version[v] });
+        }
+        void push_ring(const int v) {
+            for (const int t : ring[v]) {
+                if (!alive[t]) continue;
+                for (int k = 0; k < 3; k++) {
+                    const int w = vrt[t * 3 + k];
+                    if (w == v) continue;
+                    push(v, w);
+                    push(w, v);
+                }
+            }
+        }
+        void neighbors(const int v, std::vector<int>& out) const {
+            out.clear();
+            for (const int t : ring[v]) {
+                if (!alive[t]) continue;
+                for (int k = 0; k < 3; k++) if (vrt[t * 3 + k] != v) out.push_back(vrt[t * 3 + k]);
+            }
+            std::sort(out.begin(), out.end());
+            out.erase(std::unique(out.begin(), out.end()), out.end());
+        }
+        bool valid(const int u, const int v) { // the mesh stays manifold and no triangle flips
+            std::vector<int> opposite, nu, nv, common;
+            for (const int t : ring[u]) {
+                if (!alive[t] || corner(t, v) < 0) continue;
+                for (int k = 0; k < 3; k++) if (vrt[t * 3 + k] != u && vrt[t * 3 + k] != v) opposite.push_back(vrt[t * 3 + k]);
+            }
+            if (opposite.empty()) return false; // the edge is gone
+            neighbors(u, nu);
+            neighbors(v, nv);
+            std::set_intersection(nu.begin(), nu.end(), nv.begin(), nv.end(), std::back_inserter(common));
+            std::sort(opposite.begin(), opposite.end());
+            if (common != opposite) return false; // link condition
+            for (const int t : ring[u]) {
+                if (!alive[t] || corner(t, v) >= 0) continue;
+                const vec3 p[3] = { pos[vrt[t * 3]], pos[vrt[t * 3 + 1]], pos[vrt[t * 3 + 2]] };
+                vec3 q[3] = { p[0], p[1], p[2] };
+                q[corner(t, u)] = pos[v];
+                const vec3 before = cross(p[1] - p[0], p[2] - p[0]), after = cross(q[1] - q[0], q[2] - q[0]);
+                if (before * after <= 0) return false;
+            }
+            return true;
+        }
+        void collapse(const int u, const int v, const double cost) {
+            int vn = -1, vt = -1; // attributes of v on the side of u, u is not on a seam
+            for (const int t : ring[u]) {
+                if (!alive[t]) continue;
+                const int k = corner(t, v);
+                if (k < 0) continue;
+                vn = nrm[t * 3 + k];
+                vt = tex[t * 3 + k];
+                alive[t] = 0;
+                live--;
+            }
+            for (const int t : ring[u]) {
+                if (!alive[t]) continue;
+                const int k = corner(t, u);
+                vrt[t * 3 + k] = v;
+                nrm[t * 3 + k] = vn;
+                tex[t * 3 + k] = vt;
+                ring[v].push_back(t);
+            }
+            ring[u].clear();
+            quadric[v] = quadric[u] + quadric[v];
+            version[u]++;
+            version[v]++;
+            max_cost = std::max(max_cost, cost);
+            push_ring(v);
+        }
+    public:
+        int live = 0;
+
+        Simplifier(const vec4* verts, const int nverts, const int* facet_vrt, const int* facet_nrm, const int* facet_tex, const int nfaces)
+            : pos(nverts), vrt(facet_vrt, facet_vrt + nfaces * 3), nrm(facet_nrm, facet_nrm + nfaces * 3), tex(facet_tex, facet_tex + nfaces * 3),
+            alive(nfaces, 1), ring(nverts), locked(nverts, 0), version(nverts, 0), quadric(nverts), live(nfaces) {
+            for (int i = 0; i < nverts; i++) pos[i] = verts[i].xyz();
+            std::vector<int> first_nrm(nverts, -1), first_tex(nverts, -1);
+            std::vector<std::uint64_t> edges;
+            for (int t = 0; t < nfaces; t++) {
+                const int* c = &vrt[t * 3];
+                const vec3 e = cross(pos[c[1]] - pos[c[0]], pos[c[2]] - pos[c[0]]);
+                const vec3 n = norm(e) > 0 ? e / norm(e) : vec3{ 0, 0, 0 }; // degenerate triangles add no plane
+                for (int k = 0; k < 3; k++) {
+                    const int v = c[k];
+                    ring[v].push_back(t);
+                    quadric[v].add_plane(n, -(n * pos[c[0]]));
+                    if (first_nrm[v] < 0) first_nrm[v] = nrm[t * 3 + k];
+                    if (first_tex[v] < 0) first_tex[v] = tex[t * 3 + k];
+                    if (first_nrm[v] != nrm[t * 3 + k] || first_tex[v] != tex[t * 3 + k]) locked[v] = 1; // seam
+                    const std::uint64_t a = std::min(v, c[(k + 1) % 3]), b = std::max(v, c[(k + 1) % 3]);
+                    edges.push_back(a << 32 | b);
+                }
+            }
+            std::sort(edges.begin(), edges.end());
+            for (std::size_t i = 0, j; i < edges.size(); i = j) { // border and non-manifold edges are used once or more than twice
+                for (j = i; j < edges.size() && edges[j] == edges[i]; j++) {}
+                if (j - i == 2) continue;
+                locked[edges[i] >> 32] = 1;
+                locked[edges[i] & 0xffffffffu] = 1;
+            }
+            for (int v = 0; v < nverts; v++) push_ring(v);
+        }
+
+        void run(const int target) {
+            while (live > target && !heap.empty()) {
+                const Collapse c = heap.top();
+                heap.pop();
+                if (c.version_u != version[c.u] || c.version_v != version[c.v] || ring[c.u].empty()) continue;
+                if (valid(c.u, c.v)) collapse(c.u, c.v, c.cost);
+            }
+        }
+
+        SimplifiedLevel level() const {
+            SimplifiedLevel ret;
+            for (std::size_t t = 0; t < alive.size(); t++) {
+                if (!alive[t]) continue;
+                ret.facet_vrt.insert(ret.facet_vrt.end(), &vrt[t * 3], &vrt[t * 3] + 3);
+                ret.facet_nrm.insert(ret.facet_nrm.end(), &nrm[t * 3], &nrm[t * 3] + 3);
+                ret.facet_tex.insert(ret.facet_tex.end(), &tex[t * 3], &tex[t * 3] + 3);
+            }
+            ret.error = std::sqrt(std::max(0., max_cost));
+            return ret;
+        }
+    };
+}
+
+std::vector<SimplifiedLevel> simplify_levels(const vec4* verts, const int nverts, const int* facet_vrt, const int* facet_nrm,
+    const int* facet_tex, const int nfaces, const int max_levels, const int min_faces) {
+    std::vector<SimplifiedLevel> ret;
+    if (nfaces <= min_faces) return ret;
+    Simplifier s(verts, nverts, facet_vrt, facet_nrm, facet_tex, nfaces);
+    for (int level = 0; level < max_levels && s.live > min_faces; level++) {
+        const int before = s.live;
+        s.run(std::max(min_faces, before / 2));
+        if (s.live > before * 4 / 5) break; // stuck on seams and borders, a level this close to the previous one is not worth it
+        ret.push_back(s.level());
+    }
+    return ret;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <vector>
+#include "geometry.h"
+
+struct SimplifiedLevel { // triangles indexing the attribute arrays of the source mesh
+    std::vector<int> facet_vrt, facet_nrm, facet_tex;
+    double error = 0; // largest distance between the collapsed vertices and the planes of their original triangles, in object units
+};
+
+// Quadric error metric edge collapse (Garland and Heckbert 1997). A vertex only ever moves onto a neighbor, so that the
+// simplified triangles keep indexing the original positions, normals and uvs; vertices on a uv or normal seam, on an open
+// border or on a non-manifold edge never move, which keeps the texture mapping intact.
+// Returns successive levels of about half the triangles of the previous one, until min_faces or until no collapse is left.
+std::vector<SimplifiedLevel> simplify_levels(const vec4* verts, const int nverts, const int* facet_vrt, const int* facet_nrm,
+    const int* facet_tex, const int nfaces, const int max_levels, const int min_faces);
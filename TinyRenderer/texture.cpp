@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cmath>
+#include "texture.h"
+#include "counters.h"
+
+bool texture_cache_simulated = false;
+
+Texture::Texture(const TGAImage& img, const TextureLayout layout) {
+    if (img.width() <= 0 || img.height() <= 0) return;
+    for (int w = img.width(), h = img.height(); ; w = std::max(1, w / 2), h = std::max(1, h / 2)) {
+        levels.push_back({ w, h });
+        if (w == 1 && h == 1) break;
+    }
+    texels.resize(place_levels() * 4); // linear, the filter below reads the rows directly
+
+    const Level& base = levels[0];
+#pragma omp parallel for
+    for (int y = 0; y < base.h; y++)
+        for (int x = 0; x < base.w; x++) {
+            TGAColor c = img.get(x, y);
+            if (c.bytespp == 1) c = { c[0], c[0], c[0], 255 }; // grayscale
+            else if (c.bytespp == 3) c[3] = 255;
+            std::copy(c.bgra, c.bgra + 4, &texels[(base.offset + x + static_cast<std::size_t>(y) * base.w) * 4]);
+        }
+    for (std::size_t i = 1; i < levels.size(); i++) {
+        const Level& src = levels[i - 1];
+        const Level& dst = levels[i];
+#pragma omp parallel for
+        for (int y = 0; y < dst.h; y++)
+            for (int x = 0; x < dst.w; x++) { // odd sizes drop the last row or column
+                const int x0 = std::min(2 * x, src.w - 1), x1 = std::min(2 * x + 1, src.w - 1);
+                const int y0 = std::min(2 * y, src.h - 1), y1 = std::min(2 * y + 1, src.h - 1);
+                const std::uint8_t* p[4] = {
+                    &texels[(src.offset + x0 + static_cast<std::size_t>(y0) * src.w) * 4], &texels[(src.offset + x1 + static_cast<std::size_t>(y0) * src.w) * 4],
+                    &texels[(src.offset + x0 + static_cast<std::size_t>(y1) * src.w) * 4], &texels[(src.offset + x1 + static_cast<std::size_t>(y1) * src.w) * 4] };
+                std::uint8_t* q = &texels[(dst.offset + x + static_cast<std::size_t>(y) * dst.w) * 4];
+                for (int k = 0; k < 4; k++) q[k] = static_cast<std::uint8_t>((p[0][k] + p[1][k] + p[2][k] + p[3][k] + 2) / 4);
+            }
+    }
+    set_layout(layout);
+}
+
+Texture::Texture(const Texture& other, const TextureLayout layout) : levels(other.levels), texel_layout(other.texel_layout), texels(other.texels) {
+    set_layout(layout);
+}
+
+std::size_t Texture::place_levels() {
+    std::size_t total = 0;
+    for (Level& l : levels) {
+        l.offset = total;
+        l.tiles_x = 0;
+        l.bits_x = l.bits_y = 0;
+        if (texel_layout == TextureLayout::Tiled4 || texel_layout == TextureLayout::Tiled8) {
+            const int tile = texel_layout == TextureLayout::Tiled4 ? 4 : 8;
+            l.tiles_x = (l.w + tile - 1) / tile;
+            total += static_cast<std::size_t>(l.tiles_x) * ((l.h + tile - 1) / tile) * tile * tile;
+        }
+        else if (texel_layout == TextureLayout::Morton) {
+            while ((1 << l.bits_x) < l.w) l.bits_x++;
+            while ((1 << l.bits_y) < l.h) l.bits_y++;
+            total += std::size_t(1) << (l.bits_x + l.bits_y);
+        }
+        else total += static_cast<std::size_t>(l.w) * l.h;
+    }
+    return total;
+}
+
+void Texture::set_layout(const TextureLayout layout) {
+    if (layout == texel_layout) return;
+    const std::vector<Level> from = levels;
+    const TextureLayout from_layout = texel_layout;
+    const aligned_vector<std::uint8_t> src = std::move(texels);
+    texel_layout = layout;
+    texels.assign(place_levels() * 4, 0); // the padding stays black, the wrap modes never address it
+    for (std::size_t i = 0; i < levels.size(); i++) {
+        const Level& l = levels[i];
+#pragma omp parallel for
+        for (int y = 0; y < l.h; y++)
+            for (int x = 0; x < l.w; x++)
+                std::copy_n(&src[address(from[i], from_layout, x, y) * 4], 4, &texels[address(l, layout, x, y) * 4]);
+    }
+}
+
+double Texture::lod(const vec2& duv_dx, const vec2& duv_dy) const {
+    const double dx = norm(vec2{ duv_dx.x * width(), duv_dx.y * height() });
+    const double dy = norm(vec2{ duv_dy.x * width(), duv_dy.y * height() });
+    const double rho = std::max(dx, dy);
+    return rho > 0 ? std::log2(rho) : 0;
+}
+
+TGAColor Texture::sample(const vec2& uv, const double lod) const {
+    if (empty()) return { 255, 255, 255, 255 };
+    return Sampler<Wrap::Repeat>(*this).trilinear(uv, lod);
+}
+
+TGAColor Texture::sample_nearest(const vec2& uv) const {
+    if (empty()) return { 255, 255, 255, 255 };
+    return Sampler<Wrap::Repeat>(*this).nearest(uv);
+}
+
+std::size_t TextureFootprint::bytes() const {
+    std::size_t n = 0;
+    for (const auto& t : touched) n += t.load(std::memory_order_relaxed);
+    return n * 4;
+}
+
+void set_texture_cache_simulation(const bool enabled) {
+    texture_cache_simulated = enabled;
+}
+
+void simulate_texture_fetch(const std::uint8_t* texel) {
+    thread_local std::uintptr_t tags[512] = {}; // line address + 1 per set, 0 when empty
+    const std::uintptr_t line = reinterpret_cast<std::uintptr_t>(texel) >> 6;
+    PipelineCounters& counters = PipelineCounters::instance();
+    counters.add(Counter::TexelsFetched);
+    if (tags[line & 511] == line + 1) return;
+    tags[line & 511] = line + 1;
+    counters.add(Counter::TextureCacheMisses);
+}
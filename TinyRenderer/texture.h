@@ -0,0 +1,200 @@
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "aligned.h"
+#include "geometry.h"
+#include "tgaimage.h"
+
+enum class TextureLayout { // order of the texels of each level in memory
+    Linear, // rows, as loaded
+    Tiled4, // 4x4 tiles of 64 bytes, one cache line, stored row by row
+    Tiled8, // 8x8 tiles of 256 bytes
+    Morton  // Z-order curve over the level padded to powers of two
+};
+
+// Texture with its mip chain: BGRA texels, each level a 2x2 box filter of the previous one down to 1x1. The uv coordinates
+// are normalized, texel {x,y} of the base level covers uv [x/w, (x+1)/w) x [y/h, (y+1)/h) like TGAImage::get.
+// The shaders read it through a Sampler, sample() and sample_nearest() are shorthands for a repeating one.
+// With a tiled or Morton layout the texels close in both directions share cache lines, so that a sweep along v costs
+// about as many misses as one along u; the levels are then padded to whole tiles or to powers of two.
+class Texture {
+    struct Level {
+        int w = 0, h = 0;
+        std::size_t offset = 0; // first texel in texels
+        int tiles_x = 0;        // tiled layouts: tiles per row of tiles
+        int bits_x = 0, bits_y = 0; // Morton: log2 of the padded size
+    };
+    std::vector<Level> levels;
+    TextureLayout texel_layout = TextureLayout::Linear;
+    aligned_vector<std::uint8_t> texels; // 4 bytes per texel, all levels one after the other, cache line aligned
+
+    std::size_t place_levels(); // offsets, tiles and padding of the levels in texel_layout, returns the number of stored texels
+    static std::uint32_t spread(std::uint32_t v) { // bits of v at the even positions
+        v &= 0xffff;
+        v = (v | v << 8) & 0x00ff00ffu;
+        v = (v | v << 4) & 0x0f0f0f0fu;
+        v = (v | v << 2) & 0x33333333u;
+        return (v | v << 1) & 0x55555555u;
+    }
+    static std::size_t address(const Level& l, const TextureLayout layout, const int x, const int y) {
+        switch (layout) {
+        case TextureLayout::Tiled4: return l.offset + ((static_cast<std::size_t>(y >> 2) * l.tiles_x + (x >> 2)) << 4) + ((y & 3) << 2) + (x & 3);
+        case TextureLayout::Tiled8: return l.offset + ((static_cast<std::size_t>(y >> 3) * l.tiles_x + (x >> 3)) << 6) + ((y & 7) << 3) + (x & 7);
+        case TextureLayout::Morton: {
+            const int k = l.bits_x < l.bits_y ? l.bits_x : l.bits_y, mask = (1 << k) - 1; // interleaved over the square part
+            return l.offset + (spread(x & mask) | spread(y & mask) << 1 | static_cast<std::size_t>((x >> k) | (y >> k)) << (2 * k));
+        }
+        default: return l.offset + x + static_cast<std::size_t>(y) * l.w;
+        }
+    }
+public:
+    Texture() = default;
+    explicit Texture(const TGAImage& img, const TextureLayout layout = TextureLayout::Linear); // the levels are filtered in parallel
+    Texture(const Texture& other, const TextureLayout layout); // same texels in another layout
+    bool empty() const { return levels.empty(); }
+    int width() const { return empty() ? 0 : levels[0].w; }
+    int height() const { return empty() ? 0 : levels[0].h; }
+    int nlevels() const { return static_cast<int>(levels.size()); }
+    int level_width(const int level) const { return levels[level].w; }
+    int level_height(const int level) const { return levels[level].h; }
+    TextureLayout layout() const { return texel_layout; }
+    void set_layout(const TextureLayout layout); // reorders the texels of every level
+    std::size_t index(const int level, const int x, const int y) const { // of texel {x,y} in data(), unchecked
+        return address(levels[level], texel_layout, x, y);
+    }
+    const std::uint8_t* data() const { return texels.data(); } // 4 bytes per texel, see index()
+    std::size_t ntexels() const { return texels.size() / 4; }  // stored, padding included
+
+    // level of detail of a pixel: log2 of the number of base texels its footprint spans along its longest side,
+    // from the screen-space derivatives of the uv coordinates
+    double lod(const vec2& duv_dx, const vec2& duv_dy) const;
+    TGAColor sample(const vec2& uv, const double lod) const; // trilinear and repeating, white when empty
+    TGAColor sample_nearest(const vec2& uv) const;           // base level texel, white when empty
+
+    std::size_t bytes() const { return texels.size(); }      // of every level and of the padding of the layout
+};
+
+// Texels of one texture read through the samplers given it, kept by the caller so that the texture itself stays immutable
+// and can be shared. Several threads may mark it at once.
+class TextureFootprint {
+    std::vector<std::atomic<std::uint8_t>> touched; // per stored texel
+public:
+    explicit TextureFootprint(const Texture& t) : touched(t.ntexels()) {}
+    void mark(const std::size_t i) { touched[i].store(1, std::memory_order_relaxed); } // texel index as given by Texture::index()
+    std::size_t bytes() const; // of the distinct texels marked
+};
+
+// Simulated texture cache, to compare the layouts without hardware counters: per thread, direct-mapped, 512 lines of 64 bytes
+// like a 32 KB L1 data cache. While enabled, the fetches of the samplers with a TextureProbe count as Counter::TexelsFetched
+// and their misses as Counter::TextureCacheMisses.
+extern bool texture_cache_simulated;
+void set_texture_cache_simulation(const bool enabled);
+void simulate_texture_fetch(const std::uint8_t* texel);
+
+enum class Wrap { Repeat, Clamp, Mirror }; // addressing of the texels outside of [0, 1) uv
+
+// What a Sampler does with each texel index it fetches besides reading it, chosen at compile time
+struct NoProbe { // the rendering one, compiles away
+    void fetched(const Texture&, const std::size_t) const {}
+};
+struct TextureProbe { // instrumented: marks footprint when given and feeds the simulated texture cache while it is on
+    TextureFootprint* footprint = nullptr; // of the sampled texture
+    void fetched(const Texture& t, const std::size_t i) const {
+        if (footprint) footprint->mark(i);
+        if (texture_cache_simulated) simulate_texture_fetch(t.data() + i * 4);
+    }
+};
+
+// Filtering of a non-empty texture with the wrap modes fixed at compile time: the texel addresses are resolved once per
+// sample, the fetches themselves are unchecked. The bilinear filter works on the 4 texels of a sample at once, one
+// texel per SSE register with a channel per lane, and the trilinear filter on the 8 texels of two levels.
+template <Wrap U = Wrap::Repeat, Wrap V = U, typename Probe = NoProbe> class Sampler {
+    const Texture& tex;
+    Probe probe;
+
+    template <Wrap W> static int wrap(int x, const int n) {
+        if constexpr (W == Wrap::Clamp) return x < 0 ? 0 : x >= n ? n - 1 : x;
+        else if constexpr (W == Wrap::Mirror) {
+            x %= 2 * n;
+            if (x < 0) x += 2 * n;
+            return x < n ? x : 2 * n - 1 - x;
+        }
+        else {
+            x %= n;
+            return x < 0 ? x + n : x;
+        }
+    }
+#ifdef TR_SSE2
+    using Texel = __m128; // B, G, R, A as floats
+    static Texel load(const std::uint32_t t) {
+        const __m128i zero = _mm_setzero_si128();
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(t)), zero), zero));
+    }
+    static Texel lerp(const Texel a, const Texel b, const float t) { return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t))); }
+    static TGAColor store(const Texel c) {
+        const __m128i i = _mm_cvttps_epi32(_mm_add_ps(c, _mm_set1_ps(.5f)));
+        const __m128i s = _mm_packs_epi32(i, i);
+        const std::uint32_t packed = static_cast<std::uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(s, s))); // saturated to bytes
+        TGAColor ret;
+        std::memcpy(ret.bgra, &packed, 4);
+        return ret;
+    }
+#else
+    struct Texel { float c[4]; };
+    static Texel load(const std::uint32_t t) {
+        std::uint8_t b[4];
+        std::memcpy(b, &t, 4);
+        return { { static_cast<float>(b[0]), static_cast<float>(b[1]), static_cast<float>(b[2]), static_cast<float>(b[3]) } };
+    }
+    static Texel lerp(const Texel a, const Texel b, const float t) {
+        Texel ret;
+        for (int k = 0; k < 4; k++) ret.c[k] = a.c[k] + (b.c[k] - a.c[k]) * t;
+        return ret;
+    }
+    static TGAColor store(const Texel c) {
+        TGAColor ret;
+        for (int k = 0; k < 4; k++) ret[k] = static_cast<std::uint8_t>(std::fmin(255.f, c.c[k] + .5f));
+        return ret;
+    }
+#endif
+    Texel filter(const int level, const vec2& uv) const {
+        const int w = tex.level_width(level), h = tex.level_height(level);
+        const double x = uv.x * w - .5, y = uv.y * h - .5; // texel centers
+        const double fx = std::floor(x), fy = std::floor(y);
+        const int x0 = wrap<U>(static_cast<int>(fx), w), x1 = wrap<U>(static_cast<int>(fx) + 1, w);
+        const int y0 = wrap<V>(static_cast<int>(fy), h), y1 = wrap<V>(static_cast<int>(fy) + 1, h);
+        const float tx = static_cast<float>(x - fx), ty = static_cast<float>(y - fy);
+        const Texel top = lerp(load(fetch(level, x0, y0)), load(fetch(level, x1, y0)), tx);
+        const Texel bottom = lerp(load(fetch(level, x0, y1)), load(fetch(level, x1, y1)), tx);
+        return lerp(top, bottom, ty);
+    }
+public:
+    explicit Sampler(const Texture& t, const Probe p = {}) : tex(t), probe(p) {}
+    const Texture& texture() const { return tex; }
+
+    std::uint32_t fetch(const int level, const int x, const int y) const { // BGRA bytes in memory order, unchecked, in any layout
+        const std::size_t i = tex.index(level, x, y);
+        probe.fetched(tex, i);
+        std::uint32_t ret;
+        std::memcpy(&ret, tex.data() + i * 4, 4);
+        return ret;
+    }
+    TGAColor nearest(const vec2& uv, const int level = 0) const {
+        const int w = tex.level_width(level), h = tex.level_height(level);
+        const std::uint32_t t = fetch(level, wrap<U>(static_cast<int>(std::floor(uv.x * w)), w), wrap<V>(static_cast<int>(std::floor(uv.y * h)), h));
+        TGAColor ret;
+        std::memcpy(ret.bgra, &t, 4);
+        return ret;
+    }
+    TGAColor bilinear(const vec2& uv, const int level = 0) const { return store(filter(level, uv)); }
+    TGAColor trilinear(const vec2& uv, const double lod) const { // lod as given by Texture::lod(), clamped to the chain
+        const double level = std::fmin(std::fmax(lod, 0.), tex.nlevels() - 1.);
+        const int l0 = static_cast<int>(level);
+        const float t = static_cast<float>(level - l0);
+        return store(t > 0 ? lerp(filter(l0, uv), filter(l0 + 1, uv), t) : filter(l0, uv));
+    }
+};
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cctype>
 #include <iostream>
 #include <cstring>
 #include "tgaimage.h"
@@ -9,18 +11,19 @@ TGAImage::TGAImage(const int w, const int h, const int bpp, TGAColor c) : w(w),
 }
 
 bool TGAImage::read_tga_file(const std::string filename) {
-    std::ifstream in;
-    in.open(filename, std::ios::binary);
-    if (!in.is_open()) {
+    file.reset();
+    data.clear();
+    auto mapping = std::make_shared<MappedFile>();
+    if (!mapping->open(filename)) {
         std::cerr << "can't open file " << filename << "\n";
         return false;
     }
     TGAHeader header;
-    in.read(reinterpret_cast<char*>(&header), sizeof(header));
-    if (!in.good()) {
+    if (mapping->size() < sizeof(header)) {
         std::cerr << "an error occured while reading the header\n";
         return false;
     }
+    std::memcpy(&header, mapping->data(), sizeof(header));
     w = header.width;
     h = header.height;
     bpp = header.bitsperpixel >> 3;
@@ -29,16 +32,25 @@ bool TGAImage::read_tga_file(const std::string filename) {
         return false;
     }
     size_t nbytes = bpp * w * h;
-    data = std::vector<std::uint8_t>(nbytes, 0);
+    const std::size_t offset = sizeof(header) + header.idlength + header.colormaptype * header.colormaplength * ((header.colormapdepth + 7) / 8); // pixels start after the id and the palette
     if (3 == header.datatypecode || 2 == header.datatypecode) {
-        in.read(reinterpret_cast<char*>(data.data()), nbytes);
-        if (!in.good()) {
+        if (mapping->size() < offset + nbytes) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
+        const std::ptrdiff_t pitch = static_cast<std::ptrdiff_t>(w) * bpp;
+        const bool top_down = header.imagedescriptor & 0x20;
+        view_offset = static_cast<std::ptrdiff_t>(offset) + (top_down ? 0 : (h - 1) * pitch);
+        view_stride = top_down ? pitch : -pitch; // the orientation is resolved here, not by flip_vertically()
+        file = std::move(mapping);
+        if (header.imagedescriptor & 0x10)
+            flip_horizontally();
+        std::cerr << w << "x" << h << "/" << bpp * 8 << (file && file->is_mapped() ? " mapped" : "") << "\n";
+        return true;
     }
-    else if (10 == header.datatypecode || 11 == header.datatypecode) {
-        if (!load_rle_data(in)) {
+    data = std::vector<std::uint8_t>(nbytes, 0);
+    if (10 == header.datatypecode || 11 == header.datatypecode) {
+        if (mapping->size() < offset || !load_rle_data(mapping->data() + offset, mapping->size() - offset)) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
@@ -55,138 +67,420 @@ bool TGAImage::read_tga_file(const std::string filename) {
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream& in) {
-    size_t pixelcount = w * h;
-    size_t currentpixel = 0;
-    size_t currentbyte = 0;
-    TGAColor colorbuffer;
-    do {
-        std::uint8_t chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good()) {
+bool TGAImage::load_rle_data(const std::uint8_t* in, const std::size_t size) {
+    const std::size_t nbytes = data.size();
+    std::uint8_t* out = data.data();
+    std::size_t pos = 0, written = 0;
+    while (written < nbytes) { // the bounds are checked once per packet
+        if (pos >= size) {
+            std::cerr << "an error occured while reading the header\n";
+            return false;
+        }
+        const std::uint8_t chunkheader = in[pos++];
+        const std::size_t count = (chunkheader & 0x7f) + 1, len = count * bpp;
+        if (len > nbytes - written) {
+            std::cerr << "Too many pixels read\n";
+            return false;
+        }
+        const std::size_t packet = chunkheader < 128 ? len : bpp;
+        if (packet > size - pos) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
-        if (chunkheader < 128) {
-            chunkheader++;
-            for (int i = 0; i < chunkheader; i++) {
-                in.read(reinterpret_cast<char*>(colorbuffer.bgra), bpp);
-                if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t = 0; t < bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
+        std::uint8_t* dst = out + written;
+        if (chunkheader < 128) std::memcpy(dst, in + pos, len); // raw packet
+        else if (bpp == 1) std::memset(dst, in[pos], count);
+        else if (bpp == 4) {
+            std::uint32_t pixel;
+            std::memcpy(&pixel, in + pos, 4);
+            for (std::size_t i = 0; i < count; i++) std::memcpy(dst + i * 4, &pixel, 4); // vectorized into wide stores
         }
         else {
-            chunkheader -= 127;
-            in.read(reinterpret_cast<char*>(colorbuffer.bgra), bpp);
-            if (!in.good()) {
-                std::cerr << "an error occured while reading the header\n";
-                return false;
+            std::memcpy(dst, in + pos, bpp);
+            for (std::size_t filled = bpp; filled < len; filled *= 2) // each copy doubles the run written so far
+                std::memcpy(dst + filled, dst, std::min(filled, len - filled));
+        }
+        pos += packet;
+        written += len;
+    }
+    return true;
+}
+
+namespace {
+    constexpr int kRowsPerChunk = 32; // scanlines encoded by one task, the packets never cross them
+
+    template <int Bpp> std::uint8_t* encode_rle_row(const std::uint8_t* p, const int w, std::uint8_t* out) { // returns the end of the packets
+        auto same = [p](const int a, const int b) { return !std::memcmp(p + a * Bpp, p + b * Bpp, Bpp); };
+        for (int x = 0, n; x < w; x += n) {
+            n = 1;
+            if (x + 1 < w && same(x, x + 1)) { // run packet
+                while (x + n < w && n < 128 && same(x, x + n)) n++;
+                *out++ = static_cast<std::uint8_t>(n + 127);
+                std::memcpy(out, p + x * Bpp, Bpp);
+                out += Bpp;
             }
-            for (int i = 0; i < chunkheader; i++) {
-                for (int t = 0; t < bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+            else { // raw packet, up to the next two equal pixels
+                while (x + n < w && n < 128 && !(x + n + 1 < w && same(x + n, x + n + 1))) n++;
+                *out++ = static_cast<std::uint8_t>(n - 1);
+                std::memcpy(out, p + x * Bpp, static_cast<std::size_t>(n) * Bpp);
+                out += n * Bpp;
             }
         }
-    } while (currentpixel < pixelcount);
-    return true;
+        return out;
+    }
 }
 
-bool TGAImage::write_tga_file(const std::string filename, const bool vflip, const bool rle) const {
+void TGAImage::encode_rle_rows(const int first, const int last, std::vector<std::uint8_t>& out) const {
+    const std::size_t start = out.size();
+    out.resize(start + static_cast<std::size_t>(last - first) * w * (bpp + 1)); // at worst a header per pixel, runs pack 2 pixels or more
+    std::uint8_t* p = out.data() + start;
+    for (int y = first; y < last; y++) {
+        if (bpp == GRAYSCALE) p = encode_rle_row<1>(row(y), w, p);
+        else if (bpp == RGB) p = encode_rle_row<3>(row(y), w, p);
+        else p = encode_rle_row<4>(row(y), w, p);
+    }
+    out.resize(p - out.data());
+}
+
+std::vector<std::uint8_t> TGAImage::encode_tga(const bool vflip, const bool rle) const {
     constexpr std::uint8_t developer_area_ref[4] = { 0, 0, 0, 0 };
     constexpr std::uint8_t extension_area_ref[4] = { 0, 0, 0, 0 };
     constexpr std::uint8_t footer[18] = { 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
-    std::ofstream out;
-    out.open(filename, std::ios::binary);
-    if (!out.is_open()) {
-        std::cerr << "can't open file " << filename << "\n";
-        return false;
-    }
     TGAHeader header = {};
     header.bitsperpixel = bpp << 3;
     header.width = w;
     header.height = h;
     header.datatypecode = (bpp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
     header.imagedescriptor = vflip ? 0x00 : 0x20; // top-left or bottom-left origin
-    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    if (!out.good()) goto err;
+    std::vector<std::uint8_t> out(reinterpret_cast<const std::uint8_t*>(&header), reinterpret_cast<const std::uint8_t*>(&header) + sizeof(header));
     if (!rle) {
-        out.write(reinterpret_cast<const char*>(data.data()), w * h * bpp);
-        if (!out.good()) goto err;
-    }
-    else if (!unload_rle_data(out)) goto err;
-    out.write(reinterpret_cast<const char*>(developer_area_ref), sizeof(developer_area_ref));
-    if (!out.good()) goto err;
-    out.write(reinterpret_cast<const char*>(extension_area_ref), sizeof(extension_area_ref));
-    if (!out.good()) goto err;
-    out.write(reinterpret_cast<const char*>(footer), sizeof(footer));
-    if (!out.good()) goto err;
-    return true;
-err:
-    std::cerr << "can't dump the tga file\n";
-    return false;
-}
-
-bool TGAImage::unload_rle_data(std::ofstream& out) const {
-    const std::uint8_t max_chunk_length = 128;
-    size_t npixels = w * h;
-    size_t curpix = 0;
-    while (curpix < npixels) {
-        size_t chunkstart = curpix * bpp;
-        size_t curbyte = curpix * bpp;
-        std::uint8_t run_length = 1;
-        bool raw = true;
-        while (curpix + run_length < npixels && run_length < max_chunk_length) {
-            bool succ_eq = true;
-            for (int t = 0; succ_eq && t < bpp; t++)
-                succ_eq = (data[curbyte + t] == data[curbyte + t + bpp]);
-            curbyte += bpp;
-            if (1 == run_length)
-                raw = !succ_eq;
-            if (raw && succ_eq) {
-                run_length--;
-                break;
+        out.reserve(out.size() + static_cast<std::size_t>(w) * h * bpp + 26);
+        for (int y = 0; y < h; y++) out.insert(out.end(), row(y), row(y) + static_cast<std::size_t>(w) * bpp);
+    }
+    else { // ranges of scanlines encoded in parallel, then concatenated in order
+        std::vector<std::vector<std::uint8_t>> chunks((h + kRowsPerChunk - 1) / kRowsPerChunk);
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < static_cast<int>(chunks.size()); i++)
+            encode_rle_rows(i * kRowsPerChunk, std::min(h, (i + 1) * kRowsPerChunk), chunks[i]);
+        std::size_t total = out.size() + 26;
+        for (const auto& c : chunks) total += c.size();
+        out.reserve(total);
+        for (const auto& c : chunks) out.insert(out.end(), c.begin(), c.end());
+    }
+    out.insert(out.end(), developer_area_ref, developer_area_ref + sizeof(developer_area_ref));
+    out.insert(out.end(), extension_area_ref, extension_area_ref + sizeof(extension_area_ref));
+    out.insert(out.end(), footer, footer + sizeof(footer));
+    return out;
+}
+
+namespace {
+    bool write_bytes(const std::string& filename, const std::vector<std::uint8_t>& bytes) {
+        std::ofstream out;
+        out.open(filename, std::ios::binary);
+        if (!out.is_open()) {
+            std::cerr << "can't open file " << filename << "\n";
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        if (!out.good()) {
+            std::cerr << "can't dump the file " << filename << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    bool has_extension(const std::string& filename, const char* ext) {
+        const std::size_t n = std::strlen(ext);
+        if (filename.size() < n) return false;
+        for (std::size_t i = 0; i < n; i++)
+            if (std::tolower(static_cast<unsigned char>(filename[filename.size() - n + i])) != ext[i]) return false;
+        return true;
+    }
+
+    std::uint32_t qoi_pixel(const std::uint8_t r, const std::uint8_t g, const std::uint8_t b, const std::uint8_t a) {
+        return r | g << 8 | b << 16 | static_cast<std::uint32_t>(a) << 24;
+    }
+
+    int qoi_hash(const std::uint32_t px) {
+        return ((px & 0xff) * 3 + (px >> 8 & 0xff) * 5 + (px >> 16 & 0xff) * 7 + (px >> 24) * 11) % 64;
+    }
+
+    std::uint8_t* put_be32(std::uint8_t* p, const std::uint32_t v) {
+        for (int shift = 24; shift >= 0; shift -= 8) *p++ = static_cast<std::uint8_t>(v >> shift);
+        return p;
+    }
+}
+
+bool TGAImage::write_tga_file(const std::string filename, const bool vflip, const bool rle) const {
+    return write_bytes(filename, encode_tga(vflip, rle));
+}
+
+ImageFormat image_format(const std::string& filename) {
+    if (has_extension(filename, ".qoi")) return ImageFormat::Qoi;
+    if (has_extension(filename, ".ppm") || has_extension(filename, ".pgm")) return ImageFormat::Ppm;
+    return ImageFormat::Tga;
+}
+
+bool TGAImage::read_file(const std::string filename) {
+    switch (image_format(filename)) {
+    case ImageFormat::Qoi: return read_qoi_file(filename);
+    case ImageFormat::Ppm: return read_ppm_file(filename);
+    default: return read_tga_file(filename);
+    }
+}
+
+bool TGAImage::write_file(const std::string filename, const bool vflip, const bool rle) const {
+    switch (image_format(filename)) {
+    case ImageFormat::Qoi: return write_bytes(filename, encode_qoi(vflip));
+    case ImageFormat::Ppm: return write_bytes(filename, encode_ppm(vflip));
+    default: return write_tga_file(filename, vflip, rle);
+    }
+}
+
+std::vector<std::uint8_t> TGAImage::encode_qoi(const bool vflip) const {
+    const int channels = bpp == RGBA ? 4 : 3;
+    std::vector<std::uint8_t> out(14 + static_cast<std::size_t>(w) * h * (channels + 1) + 8); // at worst a tag per pixel
+    std::uint8_t* o = out.data();
+    for (const char c : { 'q', 'o', 'i', 'f' }) *o++ = static_cast<std::uint8_t>(c);
+    o = put_be32(put_be32(o, w), h);
+    *o++ = static_cast<std::uint8_t>(channels);
+    *o++ = 0; // sRGB with linear alpha
+    std::uint32_t index[64] = {};
+    std::uint32_t prev = qoi_pixel(0, 0, 0, 255);
+    int run = 0;
+    for (int j = 0; j < h; j++) {
+        const std::uint8_t* p = row(vflip ? h - 1 - j : j);
+        for (int x = 0; x < w; x++, p += bpp) {
+            const std::uint32_t px = bpp == GRAYSCALE ? qoi_pixel(p[0], p[0], p[0], 255) : qoi_pixel(p[2], p[1], p[0], bpp == RGBA ? p[3] : 255);
+            if (px == prev) {
+                if (++run == 62) {
+                    *o++ = static_cast<std::uint8_t>(0xc0 | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                *o++ = static_cast<std::uint8_t>(0xc0 | (run - 1));
+                run = 0;
             }
-            if (!raw && !succ_eq)
-                break;
-            run_length++;
+            const int slot = qoi_hash(px);
+            if (index[slot] == px) *o++ = static_cast<std::uint8_t>(slot); // QOI_OP_INDEX
+            else {
+                index[slot] = px;
+                if ((px >> 24) == (prev >> 24)) {
+                    const int dr = static_cast<std::int8_t>((px & 0xff) - (prev & 0xff));
+                    const int dg = static_cast<std::int8_t>((px >> 8 & 0xff) - (prev >> 8 & 0xff));
+                    const int db = static_cast<std::int8_t>((px >> 16 & 0xff) - (prev >> 16 & 0xff));
+                    const int dr_dg = dr - dg, db_dg = db - dg;
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) // QOI_OP_DIFF
+                        *o++ = static_cast<std::uint8_t>(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                    else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) { // QOI_OP_LUMA
+                        *o++ = static_cast<std::uint8_t>(0x80 | (dg + 32));
+                        *o++ = static_cast<std::uint8_t>((dr_dg + 8) << 4 | (db_dg + 8));
+                    }
+                    else { // QOI_OP_RGB
+                        *o++ = 0xfe;
+                        for (int k = 0; k < 3; k++) *o++ = static_cast<std::uint8_t>(px >> (8 * k));
+                    }
+                }
+                else { // QOI_OP_RGBA
+                    *o++ = 0xff;
+                    for (int k = 0; k < 4; k++) *o++ = static_cast<std::uint8_t>(px >> (8 * k));
+                }
+            }
+            prev = px;
+        }
+    }
+    if (run) *o++ = static_cast<std::uint8_t>(0xc0 | (run - 1));
+    for (int k = 0; k < 7; k++) *o++ = 0;
+    *o++ = 1;
+    out.resize(o - out.data());
+    return out;
+}
+
+std::vector<std::uint8_t> TGAImage::encode_ppm(const bool vflip) const {
+    const int channels = bpp == GRAYSCALE ? 1 : 3; // the alpha channel is dropped
+    const std::string header = std::string(channels == 1 ? "P5" : "P6") + "\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n";
+    std::vector<std::uint8_t> out(header.size() + static_cast<std::size_t>(w) * h * channels);
+    std::memcpy(out.data(), header.data(), header.size());
+    std::uint8_t* o = out.data() + header.size();
+    for (int j = 0; j < h; j++) {
+        const std::uint8_t* p = row(vflip ? h - 1 - j : j);
+        if (channels == 1) {
+            std::memcpy(o, p, w);
+            o += w;
         }
-        curpix += run_length;
-        out.put(raw ? run_length - 1 : run_length + 127);
-        if (!out.good()) return false;
-        out.write(reinterpret_cast<const char*>(data.data() + chunkstart), (raw ? run_length * bpp : bpp));
-        if (!out.good()) return false;
+        else
+            for (int x = 0; x < w; x++, p += bpp) {
+                *o++ = p[2];
+                *o++ = p[1];
+                *o++ = p[0];
+            }
+    }
+    return out;
+}
+
+bool TGAImage::read_qoi_file(const std::string filename) {
+    file.reset();
+    data.clear();
+    w = h = 0;
+    MappedFile in;
+    if (!in.open(filename)) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    const std::uint8_t* p = in.data();
+    const std::uint8_t* end = p + in.size();
+    if (in.size() < 22 || std::memcmp(p, "qoif", 4)) {
+        std::cerr << "an error occured while reading the header\n";
+        return false;
+    }
+    auto be32 = [](const std::uint8_t* q) { return static_cast<std::uint32_t>(q[0]) << 24 | q[1] << 16 | q[2] << 8 | q[3]; };
+    const std::uint32_t width = be32(p + 4), height = be32(p + 8);
+    const int channels = p[12];
+    if (!width || !height || width > 65535 || height > 65535 || (channels != 3 && channels != 4)) {
+        std::cerr << "bad bpp (or width/height) value\n";
+        return false;
     }
+    w = static_cast<int>(width);
+    h = static_cast<int>(height);
+    bpp = static_cast<std::uint8_t>(channels);
+    data.resize(static_cast<std::size_t>(w) * h * bpp);
+    p += 14;
+    end -= 8; // end marker
+    std::uint32_t index[64] = {};
+    std::uint32_t px = qoi_pixel(0, 0, 0, 255);
+    std::uint8_t* o = data.data();
+    std::uint8_t* const last = o + data.size();
+    while (o < last) {
+        if (p >= end) {
+            std::cerr << "an error occured while reading the data\n";
+            return false;
+        }
+        const std::uint8_t tag = *p++;
+        int count = 1;
+        if (tag == 0xfe || tag == 0xff) {
+            const int n = tag == 0xfe ? 3 : 4;
+            if (end - p < n) {
+                std::cerr << "an error occured while reading the data\n";
+                return false;
+            }
+            px = qoi_pixel(p[0], p[1], p[2], n == 4 ? p[3] : static_cast<std::uint8_t>(px >> 24));
+            p += n;
+        }
+        else if ((tag & 0xc0) == 0x00) px = index[tag];
+        else if ((tag & 0xc0) == 0x40) {
+            const std::uint8_t r = static_cast<std::uint8_t>((px & 0xff) + ((tag >> 4 & 3) - 2));
+            const std::uint8_t g = static_cast<std::uint8_t>((px >> 8 & 0xff) + ((tag >> 2 & 3) - 2));
+            const std::uint8_t b = static_cast<std::uint8_t>((px >> 16 & 0xff) + ((tag & 3) - 2));
+            px = qoi_pixel(r, g, b, static_cast<std::uint8_t>(px >> 24));
+        }
+        else if ((tag & 0xc0) == 0x80) {
+            if (p >= end) {
+                std::cerr << "an error occured while reading the data\n";
+                return false;
+            }
+            const int dg = (tag & 0x3f) - 32, dr_dg = (*p >> 4) - 8, db_dg = (*p & 0x0f) - 8;
+            p++;
+            const std::uint8_t r = static_cast<std::uint8_t>((px & 0xff) + dg + dr_dg);
+            const std::uint8_t g = static_cast<std::uint8_t>((px >> 8 & 0xff) + dg);
+            const std::uint8_t b = static_cast<std::uint8_t>((px >> 16 & 0xff) + dg + db_dg);
+            px = qoi_pixel(r, g, b, static_cast<std::uint8_t>(px >> 24));
+        }
+        else count = (tag & 0x3f) + 1; // run of the previous pixel
+        index[qoi_hash(px)] = px;
+        if (count > (last - o) / bpp) {
+            std::cerr << "Too many pixels read\n";
+            return false;
+        }
+        for (int i = 0; i < count; i++, o += bpp) { // stored as BGRA like the TGA files
+            o[0] = static_cast<std::uint8_t>(px >> 16);
+            o[1] = static_cast<std::uint8_t>(px >> 8);
+            o[2] = static_cast<std::uint8_t>(px);
+            if (bpp == RGBA) o[3] = static_cast<std::uint8_t>(px >> 24);
+        }
+    }
+    std::cerr << w << "x" << h << "/" << bpp * 8 << "\n";
+    return true;
+}
+
+bool TGAImage::read_ppm_file(const std::string filename) {
+    file.reset();
+    data.clear();
+    w = h = 0;
+    MappedFile in;
+    if (!in.open(filename)) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    const std::uint8_t* p = in.data();
+    const std::uint8_t* end = p + in.size();
+    auto next_number = [&p, end]() { // after whitespace and # comments, -1 when missing
+        for (;;) {
+            while (p < end && std::isspace(*p)) p++;
+            if (p < end && *p == '#') while (p < end && *p != '\n') p++;
+            else break;
+        }
+        long v = -1;
+        for (; p < end && std::isdigit(*p) && v < 1 << 20; p++) v = (v < 0 ? 0 : v * 10) + (*p - '0');
+        return v;
+    };
+    if (in.size() < 2 || p[0] != 'P' || (p[1] != '5' && p[1] != '6')) {
+        std::cerr << "an error occured while reading the header\n";
+        return false;
+    }
+    const int channels = p[1] == '5' ? 1 : 3;
+    p += 2;
+    const long width = next_number(), height = next_number(), maxval = next_number();
+    if (width <= 0 || height <= 0 || width > 65535 || height > 65535 || maxval != 255 || p >= end || !std::isspace(*p)) {
+        std::cerr << "bad bpp (or width/height) value\n";
+        return false;
+    }
+    p++; // the single whitespace before the pixels
+    const std::size_t n = static_cast<std::size_t>(width) * height;
+    if (static_cast<std::size_t>(end - p) < n * channels) {
+        std::cerr << "an error occured while reading the data\n";
+        return false;
+    }
+    w = static_cast<int>(width);
+    h = static_cast<int>(height);
+    bpp = static_cast<std::uint8_t>(channels);
+    data.resize(n * channels);
+    if (channels == 1) std::memcpy(data.data(), p, n);
+    else
+        for (std::size_t i = 0; i < n; i++) { // RGB to BGR
+            data[i * 3] = p[i * 3 + 2];
+            data[i * 3 + 1] = p[i * 3 + 1];
+            data[i * 3 + 2] = p[i * 3];
+        }
+    std::cerr << w << "x" << h << "/" << bpp * 8 << "\n";
     return true;
 }
 
 TGAColor TGAImage::get(const int x, const int y) const {
-    if (!data.size() || x < 0 || y < 0 || x >= w || y >= h) return {};
+    if ((!data.size() && !file) || x < 0 || y < 0 || x >= w || y >= h) return {};
     TGAColor ret = { 0, 0, 0, 0, bpp };
-    const std::uint8_t* p = data.data() + (x + y * w) * bpp;
+    const std::uint8_t* p = row(y) + x * bpp;
     for (int i = bpp; i--; ret.bgra[i] = p[i]);
     return ret;
 }
 
 void TGAImage::set(int x, int y, const TGAColor& c) {
+    if (file) materialize();
     if (!data.size() || x < 0 || y < 0 || x >= w || y >= h) return;
     memcpy(data.data() + (x + y * w) * bpp, c.bgra, bpp);
 }
 
+void TGAImage::materialize() {
+    if (!file) return;
+    std::vector<std::uint8_t> pixels(static_cast<std::size_t>(w) * h * bpp);
+    for (int y = 0; y < h; y++) memcpy(pixels.data() + static_cast<std::size_t>(y) * w * bpp, row(y), static_cast<std::size_t>(w) * bpp);
+    data = std::move(pixels);
+    file.reset();
+}
+
 void TGAImage::flip_horizontally() {
+    materialize();
     for (int i = 0; i < w / 2; i++)
         for (int j = 0; j < h; j++)
             for (int b = 0; b < bpp; b++)
@@ -194,10 +488,14 @@ void TGAImage::flip_horizontally() {
 }
 
 void TGAImage::flip_vertically() {
-    for (int i = 0; i < w; i++)
-        for (int j = 0; j < h / 2; j++)
-            for (int b = 0; b < bpp; b++)
-                std::swap(data[(i + j * w) * bpp + b], data[(i + (h - 1 - j) * w) * bpp + b]);
+    if (file) { // a view only reverses its stride
+        view_offset += (h - 1) * view_stride;
+        view_stride = -view_stride;
+        return;
+    }
+    const std::size_t pitch = static_cast<std::size_t>(w) * bpp;
+    for (int j = 0; j < h / 2; j++)
+        std::swap_ranges(data.begin() + j * pitch, data.begin() + (j + 1) * pitch, data.begin() + (h - 1 - j) * pitch);
 }
 
 int TGAImage::width() const {
@@ -207,3 +505,11 @@ int TGAImage::width() const {
 int TGAImage::height() const {
     return h;
 }
+
+int TGAImage::bytespp() const {
+    return bpp;
+}
+
+const std::uint8_t* TGAImage::buffer() const {
+    return row(0);
+}
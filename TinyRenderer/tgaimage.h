@@ -1,7 +1,11 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 #include <fstream>
+#include <memory>
+#include <string>
 #include <vector>
+#include "mapped_file.h"
 
 #pragma pack(push,1)
 struct TGAHeader {
@@ -20,6 +24,13 @@ struct TGAHeader {
 };
 #pragma pack(pop)
 
+enum class ImageFormat { // of the files written by TGAImage::write_file(), chosen by their extension
+    Tga, // RLE or not, the default
+    Qoi, // .qoi, "Quite OK Image" lossless compression in a single pass, 3 or 4 channels
+    Ppm  // .ppm or .pgm, raw RGB or grayscale without alpha
+};
+ImageFormat image_format(const std::string& filename);
+
 struct TGAColor {
     std::uint8_t bgra[4] = { 0,0,0,0 };
     std::uint8_t bytespp = 4;
@@ -27,22 +38,42 @@ struct TGAColor {
     const std::uint8_t& operator[](const int i) const { return bgra[i]; }
 };
 
+// The pixels of an uncompressed file are not copied: the image is a view into the mapped file, its rows read bottom-up
+// through a negative stride when the file stores them so. The first set() or flip_horizontally() copies them into memory.
 struct TGAImage {
     enum Format { GRAYSCALE = 1, RGB = 3, RGBA = 4 };
     TGAImage() = default;
     TGAImage(const int w, const int h, const int bpp, TGAColor c = {});
-    bool  read_tga_file(const std::string filename);
+    bool  read_tga_file(const std::string filename);        // maps the uncompressed files, decodes the RLE ones
     bool write_tga_file(const std::string filename, const bool vflip = true, const bool rle = true) const;
+    std::vector<std::uint8_t> encode_tga(const bool vflip = true, const bool rle = true) const; // the bytes of the file, RLE scanlines encoded in parallel
+    bool  read_qoi_file(const std::string filename);
+    bool  read_ppm_file(const std::string filename);        // binary P5 or P6 with 8-bit samples
+    std::vector<std::uint8_t> encode_qoi(const bool vflip = true) const; // vflip writes the rows bottom-up, grayscale as RGB
+    std::vector<std::uint8_t> encode_ppm(const bool vflip = true) const; // vflip writes the rows bottom-up, RGBA as RGB
+    bool  read_file(const std::string filename);            // in the format of the extension, see ImageFormat
+    bool write_file(const std::string filename, const bool vflip = true, const bool rle = true) const; // same, rle for TGA only
     void flip_horizontally();
     void flip_vertically();
     TGAColor get(const int x, const int y) const;
     void set(const int x, const int y, const TGAColor& c);
     int width()  const;
     int height() const;
+    int bytespp() const;
+    const std::uint8_t* buffer() const; // raw pixels, rows of stride() bytes
+    const std::uint8_t* row(const int y) const { // width()*bytespp() bytes, unchecked
+        return file ? file->data() + view_offset + y * view_stride : data.data() + static_cast<std::size_t>(y) * w * bpp;
+    }
+    std::ptrdiff_t stride() const { return file ? view_stride : static_cast<std::ptrdiff_t>(w) * bpp; }
+    bool mapped() const { return file != nullptr; } // pixels read in place from the file
 private:
-    bool   load_rle_data(std::ifstream& in);
-    bool unload_rle_data(std::ofstream& out) const;
+    bool   load_rle_data(const std::uint8_t* in, const std::size_t size); // the whole payload, runs and raw packets may cross rows
+    void encode_rle_rows(const int first, const int last, std::vector<std::uint8_t>& out) const; // appends packets, none across scanlines
+    void materialize(); // copies the pixels of a view into data
     int w = 0, h = 0;
     std::uint8_t bpp = 0;
-    std::vector<std::uint8_t> data = {};
+    std::vector<std::uint8_t> data = {};   // empty while the image is a view
+    std::shared_ptr<const MappedFile> file = {}; // shared by the copies of a view
+    std::ptrdiff_t view_offset = 0;        // of row 0 in the file
+    std::ptrdiff_t view_stride = 0;        // from a row to the next in the file
 };
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cmath>
+#include "vertex_stage.h"
+
+namespace {
+    void plane_range(const vec4& p, const Bounds& b, double& lo, double& hi) { // plane values over the sphere and over the box, the tighter one
+        const vec3 extent = (b.max - b.min) / 2;
+        const double c = p.x * b.center.x + p.y * b.center.y + p.z * b.center.z + p.w;
+        const double r = std::min(std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z) * b.radius,
+            std::abs(p.x) * extent.x + std::abs(p.y) * extent.y + std::abs(p.z) * extent.z);
+        lo = c - r;
+        hi = c + r;
+    }
+
+    constexpr int kBlock = 1024;             // positions per batch, sized to stay in the L1 cache
+    constexpr int kParallelVertices = 16384; // fewer visible vertices are transformed on the calling thread
+
+    // outcodes of clip-space positions: the screen position is V*clip/w, compared to [-1, size] on both axes
+    void compute_outcodes(const float* x, const float* y, const float* z, const float* w, const int count,
+        const float vx[4], const float vy[4], const float width, const float height, std::uint8_t* out) {
+        int i = 0;
+#ifdef TR_SSE2
+        const __m128 zero = _mm_setzero_ps(), fw = _mm_set1_ps(width), fh = _mm_set1_ps(height);
+        for (; i + 4 <= count; i += 4) {
+            const __m128 X = _mm_loadu_ps(x + i), Y = _mm_loadu_ps(y + i), Z = _mm_loadu_ps(z + i), W = _mm_loadu_ps(w + i);
+            const __m128 sx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(vx[0]), X), _mm_mul_ps(_mm_set1_ps(vx[1]), Y)),
+                _mm_mul_ps(_mm_set1_ps(vx[2]), Z)), _mm_mul_ps(_mm_set1_ps(vx[3]), W));
+            const __m128 sy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(vy[0]), X), _mm_mul_ps(_mm_set1_ps(vy[1]), Y)),
+                _mm_mul_ps(_mm_set1_ps(vy[2]), Z)), _mm_mul_ps(_mm_set1_ps(vy[3]), W));
+            const __m128 front = _mm_cmpgt_ps(W, zero);
+            const int left = _mm_movemask_ps(_mm_and_ps(front, _mm_cmplt_ps(_mm_add_ps(sx, W), zero)));
+            const int right = _mm_movemask_ps(_mm_and_ps(front, _mm_cmpgt_ps(_mm_sub_ps(sx, _mm_mul_ps(fw, W)), zero)));
+            const int top = _mm_movemask_ps(_mm_and_ps(front, _mm_cmplt_ps(_mm_add_ps(sy, W), zero)));
+            const int bottom = _mm_movemask_ps(_mm_and_ps(front, _mm_cmpgt_ps(_mm_sub_ps(sy, _mm_mul_ps(fh, W)), zero)));
+            for (int k = 0; k < 4; k++)
+                out[i + k] = static_cast<std::uint8_t>(((left >> k) & 1) * OutLeft | ((right >> k) & 1) * OutRight |
+                    ((top >> k) & 1) * OutTop | ((bottom >> k) & 1) * OutBottom);
+        }
+#endif
+        for (; i < count; i++) {
+            const float sx = vx[0] * x[i] + vx[1] * y[i] + vx[2] * z[i] + vx[3] * w[i];
+            const float sy = vy[0] * x[i] + vy[1] * y[i] + vy[2] * z[i] + vy[3] * w[i];
+            std::uint8_t code = 0;
+            if (w[i] > 0) {
+                if (sx + w[i] < 0) code |= OutLeft;
+                if (sx - width * w[i] > 0) code |= OutRight;
+                if (sy + w[i] < 0) code |= OutTop;
+                if (sy - height * w[i] > 0) code |= OutBottom;
+            }
+            out[i] = code;
+        }
+    }
+}
+
+Frustum screen_frustum(const mat<4, 4>& object_to_clip, const mat<4, 4>& viewport, const int width, const int height) {
+    auto plane = [&object_to_clip](const vec4& a) { // a * clip expressed in object coordinates
+        vec4 ret = { 0, 0, 0, 0 };
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++) ret[j] += a[i] * object_to_clip[i][j];
+        return ret;
+        };
+    const vec4 vx = viewport[0], vy = viewport[1];
+    Frustum f;
+    f.planes[0] = plane(vx + vec4{ 0, 0, 0, 1 });                     // sx + w >= 0
+    f.planes[1] = plane(vec4{ 0, 0, 0, double(width) } - vx);          // width * w - sx >= 0
+    f.planes[2] = plane(vy + vec4{ 0, 0, 0, 1 });
+    f.planes[3] = plane(vec4{ 0, 0, 0, double(height) } - vy);
+    f.front = plane({ 0, 0, 0, 1 });
+
+    // the eye projects to x = y = w = 0: it spans the null space of these three rows, given by their 3x3 minors
+    const vec4 rows[3] = { object_to_clip[0], object_to_clip[1], object_to_clip[3] };
+    vec4 eye;
+    for (int j = 0; j < 4; j++) {
+        mat<3, 3> minor;
+        for (int i = 0; i < 3; i++)
+            for (int k = 0, col = 0; k < 4; k++)
+                if (k != j) minor[i][col++] = rows[i][k];
+        eye[j] = (j % 2 ? -1 : 1) * minor.det();
+    }
+    f.has_eye = std::abs(eye.w) > 1e-12 * (std::abs(eye.x) + std::abs(eye.y) + std::abs(eye.z));
+    if (f.has_eye) f.eye = { eye.x / eye.w, eye.y / eye.w, eye.z / eye.w };
+    return f;
+}
+
+bool Frustum::culls(const Bounds& b) const {
+    double lo, hi;
+    plane_range(front, b, lo, hi);
+    if (lo <= 0) return false; // possibly behind the eye, where the outcodes are not computed either
+    for (const vec4& p : planes) {
+        plane_range(p, b, lo, hi);
+        if (hi < 0) return true;
+    }
+    return false;
+}
+
+bool Frustum::contains(const Bounds& b) const {
+    double lo, hi;
+    plane_range(front, b, lo, hi);
+    if (lo <= 0) return false;
+    for (const vec4& p : planes) {
+        plane_range(p, b, lo, hi);
+        if (lo < 0) return false;
+    }
+    return true;
+}
+
+bool Frustum::faces_away(const Meshlet& m) const {
+    // rasterize() keeps the triangles whose normal cross(b-a, c-a) points to the eye. The apex lies behind every triangle plane,
+    // so seen from any eye within 90 degrees minus the cone half angle of the axis behind the apex, all the normals point away.
+    // Behind the eye the screen-space winding flips, so only meshlets entirely in front are considered.
+    if (!has_eye || m.cone_sin >= 1) return false;
+    const Bounds& b = m.bounds;
+    if (front * vec4{ b.center.x, b.center.y, b.center.z, 1 } - norm(front.xyz()) * b.radius <= 0) return false;
+    const vec3 d = m.cone_apex - eye;
+    return d * m.cone_axis > m.cone_sin * norm(d);
+}
+
+void transform_meshlets(const Model& model, const std::vector<int>& meshlets, const mat<4, 4>& object_to_eye, const mat<4, 4>& projection,
+    const mat<4, 4>& viewport, const int width, const int height, VertexBuffer& out) {
+    const std::size_t padded = simd_padded(model.nverts());
+    for (aligned_vector<float>* a : { &out.x, &out.y, &out.z, &out.w, &out.ex, &out.ey, &out.ez })
+        if (a->size() < padded) a->resize(padded);
+    if (out.outcodes.size() < padded) out.outcodes.resize(padded);
+    if (out.seen.size() < padded) out.seen.resize(padded); // the new entries are zero like the others
+
+    // the vertices of the visible meshlets, each once even when shared by several of them
+    std::vector<int>& list = out.vertices;
+    list.clear();
+    const int* indices = model.meshlet_vertices();
+    const std::vector<Meshlet>& all = model.meshlets();
+    for (const int m : meshlets)
+        for (int i = all[m].vertex_offset; i < all[m].vertex_offset + all[m].vertex_count; i++) {
+            if (out.seen[indices[i]]) continue;
+            out.seen[indices[i]] = 1;
+            list.push_back(indices[i]);
+        }
+    for (const int v : list) out.seen[v] = 0;
+    const int n = static_cast<int>(list.size());
+    out.n = n;
+
+    const mat4f eye = cast<float>(object_to_eye), clip = cast<float>(projection * object_to_eye);
+    const float vx[4] = { float(viewport[0][0]), float(viewport[0][1]), float(viewport[0][2]), float(viewport[0][3]) };
+    const float vy[4] = { float(viewport[1][0]), float(viewport[1][1]), float(viewport[1][2]), float(viewport[1][3]) };
+    const VertexStorage storage = model.storage();
+    const Float3Stream soa = model.positions();
+    const int nblocks = (n + kBlock - 1) / kBlock;
+
+#pragma omp parallel for if(n >= kParallelVertices)
+    for (int b = 0; b < nblocks; b++) {
+        const int first = b * kBlock, count = std::min(kBlock, n - first);
+        const int* idx = list.data() + first;
+        alignas(64) float px[kBlock], py[kBlock], pz[kBlock];                             // gathered positions
+        alignas(64) float cx[kBlock], cy[kBlock], cz[kBlock], cw[kBlock], ex[kBlock], ey[kBlock], ez[kBlock], ew[kBlock];
+        alignas(64) std::uint8_t codes[kBlock];
+        if (storage == VertexStorage::Quantized) decode_positions(model.quantized(), idx, count, px, py, pz);
+        else if (storage == VertexStorage::Float32)
+            for (int i = 0; i < count; i++) {
+                px[i] = soa.x[idx[i]];
+                py[i] = soa.y[idx[i]];
+                pz[i] = soa.z[idx[i]];
+            }
+        else
+            for (int i = 0; i < count; i++) {
+                const vec4 v = model.vert(idx[i]);
+                px[i] = static_cast<float>(v.x);
+                py[i] = static_cast<float>(v.y);
+                pz[i] = static_cast<float>(v.z);
+            }
+        transform_points(eye, px, py, pz, count, ex, ey, ez, ew);
+        transform_points(clip, px, py, pz, count, cx, cy, cz, cw);
+        compute_outcodes(cx, cy, cz, cw, count, vx, vy, static_cast<float>(width), static_cast<float>(height), codes);
+        for (int i = 0; i < count; i++) { // scattered back to the vertex indices
+            const int v = idx[i];
+            out.x[v] = cx[i];
+            out.y[v] = cy[i];
+            out.z[v] = cz[i];
+            out.w[v] = cw[i];
+            out.ex[v] = ex[i];
+            out.ey[v] = ey[i];
+            out.ez[v] = ez[i];
+            out.outcodes[v] = codes[i];
+        }
+    }
+}
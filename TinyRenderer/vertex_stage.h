@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "aligned.h"
+#include "geometry.h"
+#include "model.h"
+
+enum Outcode : std::uint8_t { // screen borders a clip-space position lies beyond, see transform_meshlets()
+    OutLeft = 1, OutRight = 2, OutTop = 4, OutBottom = 8
+};
+
+struct VertexBuffer { // transformed positions indexed like Model::vert(i), only those of the visible meshlets are written
+    aligned_vector<float> x, y, z, w;      // clip coordinates
+    aligned_vector<float> ex, ey, ez;      // eye coordinates
+    aligned_vector<std::uint8_t> outcodes;
+    int n = 0;                             // positions transformed by the last call
+    std::vector<int> vertices;             // their indices, in the order of the meshlets
+    std::vector<std::uint8_t> seen;        // per vertex, all zero between the calls
+
+    vec4 clip(const int i) const { return { x[i], y[i], z[i], w[i] }; }
+    vec4 eye(const int i) const { return { ex[i], ey[i], ez[i], 1 }; }
+};
+
+struct Frustum { // the four screen borders as object-space planes, a point p is inside when plane * {p,1} >= 0
+    vec4 planes[4];
+    vec4 front;           // w > 0 in clip space
+    vec3 eye;             // center of projection in object coordinates
+    bool has_eye = false; // false for a parallel projection
+    bool culls(const Bounds& b) const;       // the sphere or the box lies entirely in front of the eye and beyond one border
+    bool contains(const Bounds& b) const;    // the sphere or the box lies entirely in front of the eye and inside the four borders
+    bool faces_away(const Meshlet& m) const; // every triangle of the meshlet is back-facing, seen from the eye
+};
+
+// Planes matching the outcodes of transform_meshlets(), so a culled volume only holds triangles it would have culled one by one.
+Frustum screen_frustum(const mat<4, 4>& object_to_clip, const mat<4, 4>& viewport, const int width, const int height);
+
+// Transforms the vertices of the listed meshlets by object_to_eye and then projection, each shared vertex once, in SIMD batches
+// and several threads when there are many. The work done is proportional to the visible vertices rather than to the mesh: the
+// buffers of out only grow, and its state is all the function keeps, so calls with distinct buffers may run concurrently.
+// The outcodes are computed in the same pass against the pixel centers of a width x height target seen through viewport,
+// with a one pixel margin; positions with w <= 0 get no outcode since rasterize() does not clip them either.
+void transform_meshlets(const Model& model, const std::vector<int>& meshlets, const mat<4, 4>& object_to_eye, const mat<4, 4>& projection,
+    const mat<4, 4>& viewport, const int width, const int height, VertexBuffer& out);
@@ -2,9 +2,23 @@
 #include <vector>
 
 #include "wyj_gl.h"
+#include "profiler.h"
+#include "counters.h"
 
 mat<4, 4> ModelView, Viewport, Perspective; // "OpenGL" state matrices
 std::vector<double> zbuffer;               // depth buffer
+static int buffer_width = 0, buffer_height = 0;
+
+static VertexBuffer batch; // output of the batched vertex stage, reused from draw to draw
+static std::vector<int> visible; // meshlets of the drawn model passing the culling tests
+static double lod_pixels = 1;     // largest projected simplification error allowed by draw(model), 0 keeps the full mesh
+
+static DebugView view = DebugView::Off;
+static std::vector<std::uint16_t> overdraw_buffer;  // depth-test passes per pixel
+static std::vector<std::uint32_t> shading_buffer;   // profiler ticks spent in the fragment shader per pixel
+static bool ids_enabled = false;
+static std::vector<std::uint32_t> id_buffer;        // per pixel, the draw id of the frontmost fragment
+static std::uint32_t draw_id = 0;
 
 void lookat(const vec3 eye, const vec3 center, const vec3 up) {
     vec3 n = normalized(eye - center);
@@ -24,66 +38,309 @@ void init_viewport(const int x, const int y, const int w, const int h) {
 
 void init_zbuffer(const int width, const int height) {
     zbuffer = std::vector<double>(width * height, -1000.);
+    buffer_width = width;
+    buffer_height = height;
+    if (view != DebugView::Off) set_debug_view(view);
+    if (ids_enabled) set_id_buffer(true);
 }
 
-void rasterize(const Triangle& clip, const IShader& shader, TGAImage& framebuffer) {
-    //vec4 ndc[3] = { clip[0] / clip[0].w, clip[1] / clip[1].w, clip[2] / clip[2].w };                // normalized device coordinates
-    vec4 ndc[3] = { clip[2] / clip[2].w, clip[1] / clip[1].w, clip[0] / clip[0].w };                // 坐标系不同采用不同的处理
-    vec2 screen[3] = { (Viewport * ndc[0]).xy(), (Viewport * ndc[1]).xy(), (Viewport * ndc[2]).xy() }; // screen coordinates
+void set_lod_threshold(const double pixels) {
+    lod_pixels = pixels;
+}
 
-    mat<3, 3> ABC = { { {screen[0].x, screen[0].y, 1.}, {screen[1].x, screen[1].y, 1.}, {screen[2].x, screen[2].y, 1.} } };
-    if (ABC.det() < 1) return; // backface culling + discarding triangles that cover less than a pixel
+double lod_threshold() {
+    return lod_pixels;
+}
 
-    int bbminx = std::min({ screen[0].x, screen[1].x, screen[2].x }); // bounding box for the triangle
-    int bbminy = std::min({ screen[0].y, screen[1].y, screen[2].y }); // defined by its top left and bottom right corners
-    int bbmaxx = std::max({ screen[0].x, screen[1].x, screen[2].x });
-    int bbmaxy = std::max({ screen[0].y, screen[1].y, screen[2].y });
+void set_debug_view(const DebugView v) {
+    view = v;
+    overdraw_buffer.assign(v == DebugView::Off ? 0 : buffer_width * buffer_height, 0);
+    shading_buffer.assign(v == DebugView::Off ? 0 : buffer_width * buffer_height, 0);
+}
 
-#pragma omp parallel for
-    for (int x = std::max<int>(bbminx, 0); x <= std::min<int>(bbmaxx, framebuffer.width() - 1); x++) {         // clip the bounding box by the screen
-        for (int y = std::max<int>(bbminy, 0); y <= std::min<int>(bbmaxy, framebuffer.height() - 1); y++) {
-            vec3 bc = ABC.invert_transpose() * vec3 { static_cast<double>(x), static_cast<double>(y), 1. }; // barycentric coordinates of {x,y} w.r.t the triangle
-            if (bc.x < 0 || bc.y < 0 || bc.z < 0) continue;                                                    // negative barycentric coordinate => the pixel is outside the triangle
-            double z = bc * vec3{ ndc[0].z, ndc[1].z, ndc[2].z };  // linear interpolation of the depth
-            if (z <= zbuffer[x + y * framebuffer.width()]) continue;   // discard fragments that are too deep w.r.t the z-buffer
-            //auto [discard, color] = shader.fragment(bc);
-            std::pair<bool, TGAColor> color = shader.fragment(bc);
-            if (color.first) continue;                                 // fragment shader can discard current fragment
-            zbuffer[x + y * framebuffer.width()] = z;                  // update the z-buffer
+DebugView debug_view() {
+    return view;
+}
 
-            framebuffer.set(x, y, color.second);                          // update the framebuffer
-        }
+void clear_debug_buffers() {
+    std::fill(overdraw_buffer.begin(), overdraw_buffer.end(), 0);
+    std::fill(shading_buffer.begin(), shading_buffer.end(), 0);
+    std::fill(id_buffer.begin(), id_buffer.end(), 0);
+}
+
+void set_id_buffer(const bool enabled) {
+    ids_enabled = enabled;
+    id_buffer.assign(enabled ? buffer_width * buffer_height : 0, 0);
+}
+
+void set_draw_id(const std::uint32_t id) {
+    draw_id = id;
+}
+
+std::uint32_t id_at(const int x, const int y) {
+    if (id_buffer.empty() || x < 0 || y < 0 || x >= buffer_width || y >= buffer_height) return 0;
+    return id_buffer[x + y * buffer_width];
+}
+
+int pick_instance(const int x, const int y) {
+    return static_cast<int>(id_at(x, y)) - 1;
+}
+
+static TGAColor heat_color(const double t) { // black -> blue -> cyan -> green -> yellow -> red
+    if (t <= 0) return { 0, 0, 0, 255, 3 };
+    constexpr double ramp[5][3] = { {0,0,255}, {0,255,255}, {0,255,0}, {255,255,0}, {255,0,0} }; // RGB
+    double s = std::min(t, 1.) * 4;
+    int i = std::min(static_cast<int>(s), 3);
+    double f = s - i;
+    TGAColor c = { 0, 0, 0, 255, 3 };
+    for (int ch : {0, 1, 2}) // TGAColor is stored as BGR
+        c[2 - ch] = static_cast<std::uint8_t>(ramp[i][ch] + (ramp[i + 1][ch] - ramp[i][ch]) * f);
+    return c;
+}
+
+TGAImage debug_heatmap() {
+    TGAImage heatmap(buffer_width, buffer_height, TGAImage::RGB);
+    if (view == DebugView::Off) return heatmap;
+    double scale = 1. / 8;   // overdraw: 8 depth-test passes and more saturate to red
+    if (view == DebugView::ShadingCost) {
+        std::uint32_t maxcost = *std::max_element(shading_buffer.begin(), shading_buffer.end());
+        scale = maxcost ? 1. / maxcost : 0.;
     }
+    for (int y = 0; y < buffer_height; y++)
+        for (int x = 0; x < buffer_width; x++) {
+            int i = x + y * buffer_width;
+            heatmap.set(x, y, heat_color((view == DebugView::Overdraw ? overdraw_buffer[i] : shading_buffer[i]) * scale));
+        }
+    return heatmap;
 }
 
+std::vector<int> overdraw_histogram(const int levels) {
+    std::vector<int> histogram(levels, 0);
+    for (std::uint16_t n : overdraw_buffer)
+        histogram[std::min<int>(n, levels - 1)]++;
+    return histogram;
+}
 
-void rasterize(const Triangle& clip, const IShader& shader, SDL_Renderer& renderer) {
+static void put_pixel(TGAImage& framebuffer, const int x, const int y, const TGAColor& color) {
+    framebuffer.set(x, y, color);
+}
+
+#ifndef TR_HEADLESS
+static void put_pixel(SDL_Renderer& renderer, const int x, const int y, const TGAColor& color) {
+    SDL_SetRenderDrawColor(&renderer, color[0], color[1], color[2], 255); // 设置颜色
+    SDL_RenderDrawPoint(&renderer, x, y);                                 //绘制点
+}
+#endif
+
+struct Fragment { // passed the depth test, waiting to be shaded
+    int y;
+    vec3 bc;
+    double z;
+};
+static thread_local std::vector<Fragment> column_fragments; // reused from column to column by each rasterizing thread
+
+// shared by the framebuffer and the SDL renderer, which only differ by put_pixel() and their size
+template <typename Target> static void rasterize_into(const Triangle& clip, const IShader& shader, Target& target, const int width, const int height) {
+    ProfileScope setup(Stage::Setup);
+    PipelineCounters& counters = PipelineCounters::instance();
+    counters.add(Counter::TrianglesSubmitted);
     //vec4 ndc[3] = { clip[0] / clip[0].w, clip[1] / clip[1].w, clip[2] / clip[2].w };                // normalized device coordinates
     vec4 ndc[3] = { clip[2] / clip[2].w, clip[1] / clip[1].w, clip[0] / clip[0].w };                // 坐标系不同采用不同的处理
     vec2 screen[3] = { (Viewport * ndc[0]).xy(), (Viewport * ndc[1]).xy(), (Viewport * ndc[2]).xy() }; // screen coordinates
 
     mat<3, 3> ABC = { { {screen[0].x, screen[0].y, 1.}, {screen[1].x, screen[1].y, 1.}, {screen[2].x, screen[2].y, 1.} } };
-    if (ABC.det() < 1) return; // backface culling + discarding triangles that cover less than a pixel
+    double det = ABC.det();
+    if (det < 1) { // backface culling + discarding triangles that cover less than a pixel
+        counters.add(det < 0 ? Counter::TrianglesBackfaceCulled : Counter::TrianglesTooSmall);
+        return;
+    }
 
     int bbminx = std::min({ screen[0].x, screen[1].x, screen[2].x }); // bounding box for the triangle
     int bbminy = std::min({ screen[0].y, screen[1].y, screen[2].y }); // defined by its top left and bottom right corners
     int bbmaxx = std::max({ screen[0].x, screen[1].x, screen[2].x });
     int bbmaxy = std::max({ screen[0].y, screen[1].y, screen[2].y });
+    if (bbminx < 0 || bbminy < 0 || bbmaxx > width - 1 || bbmaxy > height - 1) counters.add(Counter::TrianglesClipped);
+    if (bbmaxx >= 0 && bbmaxy >= 0 && bbminx <= width - 1 && bbminy <= height - 1) counters.add(Counter::TrianglesRasterized);
+    setup.stop();
+    const bool profiling = Profiler::instance().enabled;
+    std::uint16_t* overdraw = view == DebugView::Off ? nullptr : overdraw_buffer.data();
+    std::uint32_t* shading_cost = view == DebugView::Off ? nullptr : shading_buffer.data();
+    std::uint32_t* ids = id_buffer.empty() ? nullptr : id_buffer.data();
+    const mat<3, 3> bary = ABC.invert_transpose();
+    const vec3 dbar_dx = { bary[0][0], bary[1][0], bary[2][0] }, dbar_dy = { bary[0][1], bary[1][1], bary[2][1] }; // constant over the triangle
 
+    // each column is rasterized, then shaded: two profiler reads per column split the time between the stages, the per-fragment
+    // reads are only taken for the shading cost view
 #pragma omp parallel for
-    for (int x = std::max<int>(bbminx, 0); x <= std::min<int>(bbmaxx, ScreenWidth - 1); x++) {         // clip the bounding box by the screen
-        for (int y = std::max<int>(bbminy, 0); y <= std::min<int>(bbmaxy, ScreenHeight - 1); y++) {
-            vec3 bc = ABC.invert_transpose() * vec3 { static_cast<double>(x), static_cast<double>(y), 1. }; // barycentric coordinates of {x,y} w.r.t the triangle
+    for (int x = std::max<int>(bbminx, 0); x <= std::min<int>(bbmaxx, width - 1); x++) {         // clip the bounding box by the screen
+        const std::uint64_t column_start = profiling ? Profiler::ticks() : 0;
+        std::uint64_t tested = 0, depth_rejected = 0, discarded = 0, written = 0; // flushed to the counters once per column
+        std::vector<Fragment>& passed = column_fragments;
+        passed.clear();
+        for (int y = std::max<int>(bbminy, 0); y <= std::min<int>(bbmaxy, height - 1); y++) {
+            vec3 bc = bary * vec3{ static_cast<double>(x), static_cast<double>(y), 1. }; // barycentric coordinates of {x,y} w.r.t the triangle
             if (bc.x < 0 || bc.y < 0 || bc.z < 0) continue;                                                    // negative barycentric coordinate => the pixel is outside the triangle
+            tested++;
             double z = bc * vec3{ ndc[0].z, ndc[1].z, ndc[2].z };  // linear interpolation of the depth
-            if (z <= zbuffer[x + y * ScreenWidth]) continue;   // discard fragments that are too deep w.r.t the z-buffer
+            if (z <= zbuffer[x + y * width]) { depth_rejected++; continue; } // discard fragments that are too deep w.r.t the z-buffer
+            if (overdraw) overdraw[x + y * width]++;             // depth-test passes for the overdraw view
+            passed.push_back({ y, bc, z });                      // the other pixels of the column are not affected by its shading
+        }
+        const std::uint64_t shading_start = profiling ? Profiler::ticks() : 0;
+        for (const Fragment& f : passed) {
+            const int i = x + f.y * width;
+            const std::uint64_t fragment_start = shading_cost ? Profiler::ticks() : 0;
             //auto [discard, color] = shader.fragment(bc);
-            std::pair<bool, TGAColor> color = shader.fragment(bc);
-            if (color.first) continue;                                 // fragment shader can discard current fragment
-            zbuffer[x + y * ScreenWidth] = z;                  // update the z-buffer
+            std::pair<bool, TGAColor> color = shader.fragment_with_derivatives(f.bc, dbar_dx, dbar_dy);
+            if (shading_cost) shading_cost[i] += static_cast<std::uint32_t>(Profiler::ticks() - fragment_start);
+            if (color.first) { discarded++; continue; }                // fragment shader can discard current fragment
+            written++;
+            zbuffer[i] = f.z;                                          // update the z-buffer
+            if (ids) ids[i] = draw_id;
+
+            put_pixel(target, x, f.y, color.second);                   // update the framebuffer
+        }
+        counters.add(Counter::FragmentsTested, tested);
+        counters.add(Counter::FragmentsDepthRejected, depth_rejected);
+        counters.add(Counter::FragmentsDiscarded, discarded);
+        counters.add(Counter::FragmentsWritten, written);
+        if (profiling) {
+            Profiler::instance().add(Stage::Raster, shading_start - column_start);
+            Profiler::instance().add(Stage::Shading, Profiler::ticks() - shading_start); // the depth and color writes included
+        }
+    }
+}
+
+template <typename Target> static void draw_faces(IShader& shader, const int nfaces, Target& target) {
+    set_draw_id(0);
+    for (int f = 0; f < nfaces; f++) {
+        ProfileScope vertex(Stage::Vertex);
+        Triangle clip = { shader.vertex(f, 0), shader.vertex(f, 1), shader.vertex(f, 2) }; // assemble the primitive
+        vertex.stop();
+        PipelineCounters::instance().add(Counter::VerticesShaded, 3);
+        rasterize(clip, shader, target); // rasterize the primitive
+    }
+}
+
+void rasterize(const Triangle& clip, const IShader& shader, TGAImage& framebuffer) {
+    rasterize_into(clip, shader, framebuffer, framebuffer.width(), framebuffer.height());
+}
+
+void draw(IShader& shader, const int nfaces, TGAImage& framebuffer) {
+    draw_faces(shader, nfaces, framebuffer);
+}
+
+// the coarsest LOD level whose error stays within lod_pixels once projected at the nearest point of the mesh
+static int select_lod(const Model& model, const mat<4, 4>& object_to_clip, const Frustum& frustum) {
+    const std::vector<LodLevel>& lods = model.lods();
+    if (lod_pixels <= 0 || lods.size() < 2) return 0;
+    const Bounds& b = model.bounds();
+    const double w = frustum.front * vec4{ b.center.x, b.center.y, b.center.z, 1 } - norm(frustum.front.xyz()) * b.radius;
+    if (w <= 0) return 0; // the mesh reaches the eye plane, its projected error is unbounded
+    // an object-space displacement d moves the screen position by at most |V00| (|C0| + |ndc.x| |C3|) |d| / w along x,
+    // with C0 and C3 the rows of object_to_clip restricted to xyz and |ndc.x| <= 1 on screen, likewise along y
+    const double c0 = norm(object_to_clip[0].xyz()), c1 = norm(object_to_clip[1].xyz()), c3 = norm(object_to_clip[3].xyz());
+    const double pixels_per_unit = std::max(std::abs(Viewport[0][0]) * (c0 + c3), std::abs(Viewport[1][1]) * (c1 + c3)) / w;
+    int level = 0;
+    for (int l = 1; l < static_cast<int>(lods.size()); l++)
+        if (lods[l].error * pixels_per_unit <= lod_pixels) level = l;
+    return level;
+}
 
-            SDL_SetRenderDrawColor(&renderer, color.second[0], color.second[1], color.second[2], 255); // 设置颜色
-            SDL_RenderDrawPoint(&renderer, x, y);     //绘制点
+template <typename Target> static void draw_batched(IShader& shader, const Model& model, const mat<4, 4>& object_to_eye, Target& target, const int width, const int height) {
+    ProfileScope vertex(Stage::Vertex);
+    const mat<4, 4> object_to_clip = Perspective * object_to_eye;
+    const Frustum frustum = screen_frustum(object_to_clip, Viewport, width, height);
+    PipelineCounters& counters = PipelineCounters::instance();
+    const std::vector<Meshlet>& meshlets = model.meshlets();
+    if (frustum.culls(model.bounds())) { // the whole mesh is off screen
+        counters.add(Counter::MeshletsFrustumCulled, model.lods()[0].nmeshlets);
+        counters.add(Counter::TrianglesFrustumCulled, model.nfaces());
+        return;
+    }
+    const LodLevel& lod = model.lods()[select_lod(model, object_to_clip, frustum)];
+    counters.add(Counter::TrianglesLodSaved, model.nfaces() - lod.nfaces);
+    visible.clear();
+    for (int m = lod.first_meshlet; m < lod.first_meshlet + lod.nmeshlets; m++) { // rejected before any of their vertices is transformed
+        if (frustum.culls(meshlets[m].bounds)) {
+            counters.add(Counter::MeshletsFrustumCulled);
+            counters.add(Counter::TrianglesFrustumCulled, meshlets[m].triangle_count);
+        }
+        else if (frustum.faces_away(meshlets[m])) {
+            counters.add(Counter::MeshletsBackfaceCulled);
+            counters.add(Counter::TrianglesBackfaceCulled, meshlets[m].triangle_count);
         }
+        else visible.push_back(m);
     }
-}
\ No newline at end of file
+    transform_meshlets(model, visible, object_to_eye, Perspective, Viewport, width, height, batch);
+    vertex.stop();
+    counters.add(Counter::VerticesShaded, batch.n);
+    const std::uint8_t* corners = model.meshlet_indices();
+    const int* faces = model.meshlet_faces();
+    for (const int m : visible) {
+        const Meshlet& meshlet = meshlets[m];
+        for (int t = meshlet.triangle_offset; t < meshlet.triangle_offset + meshlet.triangle_count; t++) {
+            const int f = faces[t];
+            const int* v = model.meshlet_vertices() + meshlet.vertex_offset;
+            const int i[3] = { v[corners[t * 3]], v[corners[t * 3 + 1]], v[corners[t * 3 + 2]] };
+            if (batch.outcodes[i[0]] & batch.outcodes[i[1]] & batch.outcodes[i[2]]) {
+                counters.add(Counter::TrianglesFrustumCulled);
+                continue;
+            }
+            ProfileScope assembly(Stage::Vertex);
+            Triangle clip = { shader.transformed_vertex(f, 0, batch.eye(i[0]), batch.clip(i[0])),
+                              shader.transformed_vertex(f, 1, batch.eye(i[1]), batch.clip(i[1])),
+                              shader.transformed_vertex(f, 2, batch.eye(i[2]), batch.clip(i[2])) }; // assemble the primitive
+            assembly.stop();
+            rasterize(clip, shader, target);
+        }
+    }
+}
+
+template <typename Target> static void draw_instances(IShader& shader, const InstanceScene& scene, const int model, Target& target, const int width, const int height) {
+    const Frustum frustum = screen_frustum(Perspective * ModelView, Viewport, width, height); // in world coordinates
+    const Model& m = *scene.models()[model];
+    PipelineCounters& counters = PipelineCounters::instance();
+    static std::vector<int> on_screen;
+    scene.visible(frustum, on_screen);
+    int drawn = 0;
+    for (const int i : on_screen) {
+        const Instance& instance = scene.instances()[i];
+        if (instance.model != model) continue;
+        drawn++;
+        shader.set_instance(instance);
+        set_draw_id(i + 1);
+        draw_batched(shader, m, ModelView * instance.transform * ObjectFlip, target, width, height);
+    }
+    const int culled = static_cast<int>(scene.instances_of(model).size()) - drawn;
+    counters.add(Counter::InstancesFrustumCulled, culled);
+    counters.add(Counter::TrianglesFrustumCulled, static_cast<std::uint64_t>(culled) * m.nfaces());
+}
+
+void draw(IShader& shader, const Model& model, TGAImage& framebuffer) {
+    set_draw_id(0); // not an instance, whatever the previous draw was
+    draw_batched(shader, model, ModelView * ObjectFlip, framebuffer, framebuffer.width(), framebuffer.height());
+}
+
+void draw(IShader& shader, const InstanceScene& scene, const int model, TGAImage& framebuffer) {
+    draw_instances(shader, scene, model, framebuffer, framebuffer.width(), framebuffer.height());
+}
+
+#ifndef TR_HEADLESS
+void draw(IShader& shader, const Model& model, SDL_Renderer& renderer) {
+    set_draw_id(0);
+    draw_batched(shader, model, ModelView * ObjectFlip, renderer, ScreenWidth, ScreenHeight);
+}
+
+void draw(IShader& shader, const InstanceScene& scene, const int model, SDL_Renderer& renderer) {
+    draw_instances(shader, scene, model, renderer, ScreenWidth, ScreenHeight);
+}
+
+void rasterize(const Triangle& clip, const IShader& shader, SDL_Renderer& renderer) {
+    rasterize_into(clip, shader, renderer, ScreenWidth, ScreenHeight);
+}
+
+void draw(IShader& shader, const int nfaces, SDL_Renderer& renderer) {
+    draw_faces(shader, nfaces, renderer);
+}
+#endif
@@ -1,22 +1,71 @@
 #pragma once
+#include <vector>
+#ifndef TR_HEADLESS // headless builds (benchmark, tests) render into TGAImage only and do not need SDL
 // SDL
 #include <SDL.h>
+#endif
 
 #include "tgaimage.h"
 #include "geometry.h"
+#include "vertex_stage.h"
+#include "instances.h"
 
+#ifndef TR_HEADLESS
 extern const  int ScreenWidth;
 extern const  int ScreenHeight;
+#endif
+
+extern mat<4, 4> ModelView, Viewport, Perspective; // "OpenGL" state matrices
+extern std::vector<double> zbuffer;               // depth buffer
 
 void lookat(const vec3 eye, const vec3 center, const vec3 up);
 void init_perspective(const double f);
 void init_viewport(const int x, const int y, const int w, const int h);
 void init_zbuffer(const int width, const int height);
+void set_lod_threshold(const double pixels); // draw(model) uses the coarsest LOD level whose error projects to at most that many pixels,
+double lod_threshold();                      // 0 always draws the full mesh, 1 by default
+
+enum class DebugView { Off, Overdraw, ShadingCost }; // debug render modes: depth-test passes or shading time per pixel
+void set_debug_view(const DebugView view);
+DebugView debug_view();
+void clear_debug_buffers();                              // call once per frame together with the z-buffer clear
+TGAImage debug_heatmap();                                // false-color image of the active debug view
+std::vector<int> overdraw_histogram(const int levels = 16); // number of pixels per overdraw level, the last level counts everything above
+
+// optional per-pixel id of the frontmost fragment, for picking: 0 for the background, else the value last given to set_draw_id(),
+// which the instanced draw() sets to the instance index + 1 and the other draws reset to 0. Cleared by clear_debug_buffers().
+void set_id_buffer(const bool enabled);
+void set_draw_id(const std::uint32_t id);
+std::uint32_t id_at(const int x, const int y); // 0 outside of the screen or when disabled
+int pick_instance(const int x, const int y);   // instance under a pixel, -1 for none
 
 struct IShader {
+    virtual ~IShader() = default;
+    virtual vec4 vertex(const int face, const int vert) = 0; // clip coordinates of a triangle corner
+    virtual vec4 transformed_vertex(const int face, const int vert, const vec4& eye, const vec4& clip) { // corner already transformed by the batched vertex stage
+        return vertex(face, vert);
+    }
+    virtual void set_instance(const Instance&) {} // called by the instanced draw() before the triangles of each instance
     virtual std::pair<bool, TGAColor> fragment(const vec3 bar) const = 0;
+    // same plus the screen-space derivatives of bar, constant over the triangle, for the shaders picking a texture LOD
+    virtual std::pair<bool, TGAColor> fragment_with_derivatives(const vec3 bar, const vec3& dbar_dx, const vec3& dbar_dy) const {
+        return fragment(bar);
+    }
 };
 
 typedef vec4 Triangle[3]; // a triangle primitive is made of three ordered points 三角形原语由三个有序的点构成
 void rasterize(const Triangle& clip, const IShader& shader, TGAImage& framebuffer);
-void rasterize(const Triangle& clip, const IShader& shader, SDL_Renderer& renderer);
\ No newline at end of file
+void draw(IShader& shader, const int nfaces, TGAImage& framebuffer); // vertex stage + rasterization of faces [0, nfaces)
+// batched vertex stage with the {x,-y,z} object flip of the shaders: picks a LOD level, culls its meshlets against the screen
+// and by their normal cone, runs the vertices of the others through transform_meshlets(), drops the triangles lying beyond
+// a screen border and assembles the rest with IShader::transformed_vertex()
+void draw(IShader& shader, const Model& model, TGAImage& framebuffer);
+// instanced draw of scene.models()[model]: the instances lying off screen are culled through the bounding volume hierarchy of the
+// scene, the others are drawn like above with ModelView * Instance::transform, the vertex stage running once per instance
+void draw(IShader& shader, const InstanceScene& scene, const int model, TGAImage& framebuffer);
+#ifndef TR_HEADLESS
+void rasterize(const Triangle& clip, const IShader& shader, SDL_Renderer& renderer);
+void draw(IShader& shader, const int nfaces, SDL_Renderer& renderer);
+void draw(IShader& shader, const Model& model, SDL_Renderer& renderer);
+void draw(IShader& shader, const InstanceScene& scene, const int model, SDL_Renderer& renderer);
+#endif